@@ -0,0 +1,52 @@
+/*
+ * Copyright (c) 2018-2022 WangBin <wbsecg1 at gmail.com>
+ */
+#pragma once
+#include <atomic>
+#include <utility>
+#include <unknwn.h>
+#include <wrl/client.h>
+
+// IUnknown implementation for COM interfaces I, Is... works in all toolchains, while wrl RuntimeClass is missing in mingw
+// objects are created by make_com<T>(...)
+template<class I, class... Is>
+class ComBase : public I, public Is...
+{
+public:
+    virtual ~ComBase() = default;
+
+    HRESULT STDMETHODCALLTYPE QueryInterface(REFIID riid, void** ppv) override {
+        if (!ppv)
+            return E_POINTER;
+        *ppv = riid == __uuidof(IUnknown) ? static_cast<I*>(this) : query<I, Is...>(riid);
+        if (!*ppv)
+            return E_NOINTERFACE;
+        AddRef();
+        return S_OK;
+    }
+    ULONG STDMETHODCALLTYPE AddRef() override { return ++ref_; }
+    ULONG STDMETHODCALLTYPE Release() override {
+        const ULONG ref = --ref_;
+        if (ref == 0)
+            delete this;
+        return ref;
+    }
+private:
+    template<class T, class... Ts>
+    void* query(REFIID riid) {
+        if (riid == __uuidof(T))
+            return static_cast<T*>(this);
+        if constexpr (sizeof...(Ts) > 0)
+            return query<Ts...>(riid);
+        return nullptr;
+    }
+
+    std::atomic<ULONG> ref_{0};
+};
+
+// ref is added by ComPtr(not Attach(), which adds ref in some mingw versions)
+template<class T, typename... Args>
+Microsoft::WRL::ComPtr<T> make_com(Args&&... args)
+{
+    return Microsoft::WRL::ComPtr<T>(new T(std::forward<Args>(args)...));
+}
\ No newline at end of file
@@ -0,0 +1,228 @@
+/*
+ * Copyright (c) 2022 WangBin <wbsecg1 at gmail.com>
+ * This file is part of MDK MFT plugin
+ * Source code: https://github.com/wang-bin/mdk-mft
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+# pragma push_macro("_WIN32_WINNT")
+# if _WIN32_WINNT < 0x0602 // MF_SA_D3D11_AWARE
+#   undef _WIN32_WINNT
+#   define _WIN32_WINNT 0x0602
+# endif
+#include "MFCaps.h"
+#include "MFGlue.h"
+#include "base/fmt.h"
+#include "base/scope_atexit.h"
+#include <codecapi.h>
+#include <algorithm>
+#include <map>
+#include <mutex>
+#include <thread>
+#if __has_include(<Mftransform.h>) // msvc
+# include <Mftransform.h>
+#else // mingw
+# include <mftransform.h>
+#endif
+# pragma pop_macro("_WIN32_WINNT")
+using namespace std;
+
+MDK_NS_BEGIN
+namespace MF {
+namespace {
+struct Registry {
+    mutex mtx;
+    map<string, DecoderCaps> caps; // probed, by codec
+    map<string, pair<int, int>> sizes; // max coded size of opened transforms, by codec and d3d mode
+    mutex probe_mtx; // probe 1 codec at a time
+};
+
+Registry& registry()
+{
+    static auto r = new Registry(); // leaked. the probe thread may run after static objects are destroyed
+    return *r;
+}
+
+string size_key(const string& codec, int d3d)
+{
+    return codec + "/d3d" + to_string(d3d);
+}
+
+// microsoft decoders. hardware decoders may support more, but the transforms reject the input type
+int known_max_bit_depth(const GUID& codec)
+{
+    if (codec == MFVideoFormat_HEVC || codec == MFVideoFormat_VP90 || codec == MFVideoFormat_AV1)
+        return 10;
+    return 8;
+}
+
+int bit_depth_of(const GUID& subtype)
+{
+    if (subtype == MFVideoFormat_P010 || subtype == MFVideoFormat_P210 || subtype == MFVideoFormat_Y210)
+        return 10;
+    if (subtype == MFVideoFormat_P016 || subtype == MFVideoFormat_P216 || subtype == MFVideoFormat_Y216)
+        return 16;
+    return 8;
+}
+
+void probe_transform(IMFActivate* act, const GUID& codec, DecoderCaps& caps)
+{
+    ComPtr<IMFTransform> mft;
+    MS_ENSURE(act->ActivateObject(IID_PPV_ARGS(&mft)));
+    auto shutdown = scope_atexit([act]{ MS_WARN(act->ShutdownObject()); });
+    ComPtr<IMFAttributes> a;
+    if (SUCCEEDED(mft->GetAttributes(&a))) {
+        UINT32 v = 0;
+        caps.d3d9 = SUCCEEDED(a->GetUINT32(MF_SA_D3D_AWARE, &v)) && v;
+        v = 0;
+        caps.d3d11 = SUCCEEDED(a->GetUINT32(MF_SA_D3D11_AWARE, &v)) && v;
+        UINT32 w = 0, h = 0;
+        if (SUCCEEDED(a->GetUINT32(CODECAPI_AVDecVideoMaxCodedWidth, &w)) && SUCCEEDED(a->GetUINT32(CODECAPI_AVDecVideoMaxCodedHeight, &h))) {
+            caps.max_width = (int)w;
+            caps.max_height = (int)h;
+        }
+    }
+    DWORD id_in = 0, id_out = 0;
+    if (FAILED(mft->GetStreamIDs(1, &id_in, 1, &id_out)))
+        id_in = id_out = 0;
+    ComPtr<IMFMediaType> in;
+    MS_ENSURE(MFCreateMediaType(&in));
+    MS_ENSURE(in->SetGUID(MF_MT_MAJOR_TYPE, MFMediaType_Video));
+    MS_ENSURE(in->SetGUID(MF_MT_SUBTYPE, codec));
+    MS_ENSURE(MFSetAttributeSize(in.Get(), MF_MT_FRAME_SIZE, 1920, 1080));
+    MS_ENSURE(mft->SetInputType(id_in, in.Get(), 0));
+    ComPtr<IMFMediaType> out;
+    for (DWORD i = 0; SUCCEEDED(mft->GetOutputAvailableType(id_out, i, &out)); ++i) {
+        GUID subtype;
+        if (SUCCEEDED(out->GetGUID(MF_MT_SUBTYPE, &subtype))) {
+            caps.outputs.push_back(subtype);
+            caps.max_bit_depth = std::max<int>(caps.max_bit_depth, bit_depth_of(subtype));
+        }
+        out.Reset();
+    }
+}
+
+DecoderCaps probe(const GUID& codec)
+{
+    DecoderCaps caps;
+    caps.probed = true;
+    caps.max_bit_depth = known_max_bit_depth(codec);
+    const bool uninit_com = CoInitializeEx(nullptr, COINIT_MULTITHREADED) != RPC_E_CHANGED_MODE;
+    MS_ENSURE(MFStartup(MF_VERSION), caps);
+    auto deinit = scope_atexit([=]{
+        MS_WARN(MFShutdown());
+        if (uninit_com)
+            CoUninitialize();
+    });
+#if !(MS_WINRT+0)
+    typedef HRESULT (STDAPICALLTYPE *MFTEnumEx_fn)(GUID, UINT32, const MFT_REGISTER_TYPE_INFO*, const MFT_REGISTER_TYPE_INFO*, IMFActivate***, UINT32*);
+    MFTEnumEx_fn MFTEnumEx = nullptr;
+    HMODULE mfplat_dll = GetModuleHandleW(L"mfplat.dll");
+    if (mfplat_dll)
+        MFTEnumEx = (MFTEnumEx_fn)GetProcAddress(mfplat_dll, "MFTEnumEx");
+    if (!MFTEnumEx) // vista
+        return caps;
+#endif
+    const MFT_REGISTER_TYPE_INFO reg{MFMediaType_Video, codec};
+    const UINT32 kFlags[] = {MFT_ENUM_FLAG_HARDWARE | MFT_ENUM_FLAG_SORTANDFILTER, 0}; // 0: sync, local, sort and filter
+    for (auto flags : kFlags) {
+        IMFActivate **activates = nullptr;
+        UINT32 nb_activates = 0;
+        auto activates_deleter = scope_atexit([&]{
+            for (UINT32 i = 0; i < nb_activates; ++i)
+                activates[i]->Release();
+            CoTaskMemFree(activates);
+        });
+        MS_ENSURE(MFTEnumEx(MFT_CATEGORY_VIDEO_DECODER, flags, &reg, nullptr, &activates, &nb_activates), caps);
+        if (flags) {
+            caps.hardware = (int)nb_activates;
+            continue;
+        }
+        caps.software = (int)nb_activates;
+        if (nb_activates > 0)
+            probe_transform(activates[0], codec, caps);
+    }
+    caps.max_bit_depth = std::max<int>(caps.max_bit_depth, known_max_bit_depth(codec));
+    return caps;
+}
+} // namespace
+
+bool DecoderCaps::accepts(int width, int height, int bit_depth) const
+{
+    if (probed && software == 0)
+        return false;
+    if (width > 0 && max_width > 0 && width > max_width)
+        return false;
+    if (height > 0 && max_height > 0 && height > max_height)
+        return false;
+    if (bit_depth > 0 && max_bit_depth > 0 && bit_depth > max_bit_depth)
+        return false;
+    return true;
+}
+
+DecoderCaps decoder_caps(const string& codec, int d3d)
+{
+    DecoderCaps caps;
+    if (cached_decoder_caps(codec, &caps, d3d) && caps.probed)
+        return caps;
+    const auto id = codec_for(codec, MediaType::Video);
+    if (!id)
+        return caps;
+    auto& r = registry();
+    lock_guard<mutex> probe_lock(r.probe_mtx);
+    if (cached_decoder_caps(codec, &caps, d3d) && caps.probed) // probed by another thread
+        return caps;
+    caps = probe(*id);
+    clog << fmt::to_string("%s decoder caps: hardware %d, software %d, d3d9 %d, d3d11 %d, max %dx%d, %d bit, %d output types"
+        , codec.data(), caps.hardware, caps.software, caps.d3d9, caps.d3d11, caps.max_width, caps.max_height, caps.max_bit_depth, (int)caps.outputs.size()) << endl;
+    {
+        lock_guard<mutex> lock(r.mtx);
+        r.caps[codec] = caps;
+    }
+    cached_decoder_caps(codec, &caps, d3d);
+    return caps;
+}
+
+bool cached_decoder_caps(const string& codec, DecoderCaps* caps, int d3d)
+{
+    auto& r = registry();
+    lock_guard<mutex> lock(r.mtx);
+    const auto it = r.caps.find(codec);
+    const auto size = r.sizes.find(size_key(codec, d3d));
+    if (it == r.caps.cend() && size == r.sizes.cend())
+        return false;
+    *caps = it == r.caps.cend() ? DecoderCaps() : it->second;
+    if (d3d != 0) { // probed size is of software mode
+        caps->max_width = 0;
+        caps->max_height = 0;
+    }
+    if (size != r.sizes.cend()) {
+        caps->max_width = size->second.first;
+        caps->max_height = size->second.second;
+    }
+    return true;
+}
+
+void probe_decoder_caps_async()
+{
+    thread([]{
+        for (auto codec : {"h264", "hevc", "vp8", "vp9", "av1", "mpeg2", "vc1", "wmv3", "mjpeg"})
+            decoder_caps(codec);
+    }).detach();
+}
+
+bool can_decode(const string& codec, int width, int height, int bit_depth, int d3d)
+{
+    return decoder_caps(codec, d3d).accepts(width, height, bit_depth);
+}
+
+void update_decoder_caps(const string& codec, int d3d, int max_width, int max_height)
+{
+    auto& r = registry();
+    lock_guard<mutex> lock(r.mtx);
+    r.sizes[size_key(codec, d3d)] = {max_width, max_height};
+}
+} // namespace MF
+MDK_NS_END
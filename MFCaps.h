@@ -0,0 +1,47 @@
+/*
+ * Copyright (c) 2022 WangBin <wbsecg1 at gmail.com>
+ * This file is part of MDK MFT plugin
+ * Source code: https://github.com/wang-bin/mdk-mft
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+#pragma once
+#include "mdk/global.h"
+#include <string>
+#include <vector>
+#include <guiddef.h>
+
+MDK_NS_BEGIN
+namespace MF {
+// video decoder capabilities probed from enumerated transforms, once per codec in the process
+struct DecoderCaps {
+    bool probed = false;
+    int hardware = 0; // number of hardware(async) transforms, not used by this plugin yet
+    int software = 0; // number of sync transforms
+    // the 1st sync transform
+    bool d3d9 = false; // MF_SA_D3D_AWARE
+    bool d3d11 = false; // MF_SA_D3D11_AWARE
+    int max_width = 0; // CODECAPI_AVDecVideoMaxCodedWidth/Height, 0 if unknown
+    int max_height = 0;
+    int max_bit_depth = 0; // known limit of microsoft decoder, or from output types
+    std::vector<GUID> outputs; // output subtypes for a 1080p input type
+
+    // width, height, bit_depth <= 0: not checked
+    bool accepts(int width, int height, int bit_depth) const;
+};
+
+// d3d: 0(software), 9 or 11, i.e. decoder property "d3d". max coded size of a d3d mode is known only from opened transforms of the mode
+// probes on demand, blocks until the codec is probed. thread safe
+DecoderCaps decoder_caps(const std::string& codec, int d3d = 0);
+// returns false if nothing is known about the codec. never probes. caps->probed is false if only updated by update_decoder_caps()
+bool cached_decoder_caps(const std::string& codec, DecoderCaps* caps, int d3d = 0);
+// probes all supported video codecs in a background thread
+void probe_decoder_caps_async();
+// "can you decode codec at width x height, bit_depth?" probes on demand
+bool can_decode(const std::string& codec, int width, int height, int bit_depth = 8, int d3d = 0);
+// results of an opened transform, e.g. max coded size
+void update_decoder_caps(const std::string& codec, int d3d, int max_width, int max_height);
+} // namespace MF
+MDK_NS_END
@@ -17,6 +17,7 @@
 #include <iostream>
 #include <sstream>
 #include <string_view>
+#include <vector>
 #include "base/log.h"
 
 MDK_NS_BEGIN
@@ -126,8 +127,7 @@ Buffer2DRef to(ComPtr<IMF2DBuffer> b, ptrdiff_t offset, int size)
 }
 
 
-#if (_MSC_VER + 0) // RuntimeClass is missing in mingw
-class MFMediaBufferView : public RuntimeClass<RuntimeClassFlags<ClassicCom>, IMFMediaBuffer>  // IUnknown is implemented by RuntimeClass
+class MFMediaBufferView final : public ComBase<IMFMediaBuffer>
 {
     BufferRef buf_;
 public:
@@ -155,16 +155,251 @@ public:
         return S_OK;
     }
 };
-#endif // (_MSC_VER + 0)
 
-ComPtr<IMFMediaBuffer> from(BufferRef buf, int align)
+#if (MS_API_DESKTOP+0)
+// page aligned
+class MFNumaBuffer final : public ComBase<IMFMediaBuffer>
+{
+    BYTE* data_ = nullptr;
+    DWORD max_ = 0;
+    DWORD len_ = 0;
+public:
+    MFNumaBuffer(DWORD size, int node) {
+        data_ = (BYTE*)VirtualAllocExNuma(GetCurrentProcess(), nullptr, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE, (DWORD)node);
+        if (data_)
+            max_ = size;
+    }
+    ~MFNumaBuffer() override {
+        if (data_)
+            VirtualFree(data_, 0, MEM_RELEASE);
+    }
+    bool isValid() const { return !!data_; }
+
+    HRESULT STDMETHODCALLTYPE Lock(BYTE **ppbBuffer, _Out_opt_  DWORD *pcbMaxLength, _Out_opt_  DWORD *pcbCurrentLength) override {
+        *ppbBuffer = data_;
+        if (pcbMaxLength)
+            *pcbMaxLength = max_;
+        if (pcbCurrentLength)
+            *pcbCurrentLength = len_;
+        return S_OK;
+    }
+
+    HRESULT STDMETHODCALLTYPE Unlock() override {return S_OK;}
+
+    HRESULT STDMETHODCALLTYPE GetCurrentLength(_Out_  DWORD *pcbCurrentLength) override {
+        *pcbCurrentLength = len_;
+        return S_OK;
+    }
+
+    HRESULT STDMETHODCALLTYPE SetCurrentLength(DWORD cbCurrentLength) override {
+        if (cbCurrentLength > max_)
+            return E_INVALIDARG;
+        len_ = cbCurrentLength;
+        return S_OK;
+    }
+
+    HRESULT STDMETHODCALLTYPE GetMaxLength(_Out_  DWORD *pcbMaxLength) override {
+        *pcbMaxLength = max_;
+        return S_OK;
+    }
+};
+#endif // (MS_API_DESKTOP+0)
+
+class MFExternalBuffer final : public ComBase<IMFMediaBuffer>
+{
+    const OutputAllocator* allocator_;
+    void* cookie_;
+    BYTE* data_;
+    DWORD max_;
+    DWORD len_ = 0;
+public:
+    MFExternalBuffer(const OutputAllocator* a, BYTE* data, DWORD size, void* cookie) : allocator_(a), cookie_(cookie), data_(data), max_(size) {}
+    ~MFExternalBuffer() override {
+        allocator_->release(allocator_->opaque, cookie_);
+    }
+
+    HRESULT STDMETHODCALLTYPE Lock(BYTE **ppbBuffer, _Out_opt_  DWORD *pcbMaxLength, _Out_opt_  DWORD *pcbCurrentLength) override {
+        *ppbBuffer = data_;
+        if (pcbMaxLength)
+            *pcbMaxLength = max_;
+        if (pcbCurrentLength)
+            *pcbCurrentLength = len_;
+        return S_OK;
+    }
+
+    HRESULT STDMETHODCALLTYPE Unlock() override {return S_OK;}
+
+    HRESULT STDMETHODCALLTYPE GetCurrentLength(_Out_  DWORD *pcbCurrentLength) override {
+        *pcbCurrentLength = len_;
+        return S_OK;
+    }
+
+    HRESULT STDMETHODCALLTYPE SetCurrentLength(DWORD cbCurrentLength) override {
+        if (cbCurrentLength > max_)
+            return E_INVALIDARG;
+        len_ = cbCurrentLength;
+        return S_OK;
+    }
+
+    HRESULT STDMETHODCALLTYPE GetMaxLength(_Out_  DWORD *pcbMaxLength) override {
+        *pcbMaxLength = max_;
+        return S_OK;
+    }
+};
+
+static void copy_planes(const PlaneLayout& from, const BYTE* src, const PlaneLayout& to, BYTE* dst)
+{
+    for (int plane = 0; plane < from.planes; ++plane) {
+        const auto bytes = (size_t)std::min<int>(std::abs(from.pitch[plane]), std::abs(to.pitch[plane]));
+        for (int y = 0; y < from.rows[plane]; ++y)
+            memcpy(dst + to.offset[plane] + (ptrdiff_t)y * to.pitch[plane], src + from.offset[plane] + (ptrdiff_t)y * from.pitch[plane], bytes);
+    }
+}
+
+// video frame in application memory with allocator's pitch. software decoders write planes via Lock2D
+class MFExternalBuffer2D final : public ComBase<IMFMediaBuffer, IMF2DBuffer>
+{
+    const OutputAllocator* allocator_;
+    void* cookie_;
+    BYTE* data_;
+    PlaneLayout layout_;
+    PlaneLayout contiguous_; // no padding
+    DWORD len_ = 0;
+    std::vector<BYTE> locked_; // contiguous copy for Lock() if padded
+public:
+    MFExternalBuffer2D(const OutputAllocator* a, BYTE* data, void* cookie, const PlaneLayout& layout, const PlaneLayout& contiguous)
+        : allocator_(a), cookie_(cookie), data_(data), layout_(layout), contiguous_(contiguous) {}
+    ~MFExternalBuffer2D() override {
+        allocator_->release(allocator_->opaque, cookie_);
+    }
+    bool isContiguous() const { return layout_.pitch[0] == contiguous_.pitch[0]; }
+
+    HRESULT STDMETHODCALLTYPE Lock(BYTE **ppbBuffer, _Out_opt_  DWORD *pcbMaxLength, _Out_opt_  DWORD *pcbCurrentLength) override {
+        if (isContiguous()) {
+            *ppbBuffer = data_;
+        } else {
+            locked_.resize(contiguous_.total);
+            copy_planes(layout_, data_, contiguous_, locked_.data());
+            *ppbBuffer = locked_.data();
+        }
+        if (pcbMaxLength)
+            *pcbMaxLength = (DWORD)contiguous_.total;
+        if (pcbCurrentLength)
+            *pcbCurrentLength = len_;
+        return S_OK;
+    }
+
+    HRESULT STDMETHODCALLTYPE Unlock() override {
+        if (!locked_.empty())
+            copy_planes(contiguous_, locked_.data(), layout_, data_);
+        locked_.clear();
+        return S_OK;
+    }
+
+    HRESULT STDMETHODCALLTYPE GetCurrentLength(_Out_  DWORD *pcbCurrentLength) override {
+        *pcbCurrentLength = len_;
+        return S_OK;
+    }
+
+    HRESULT STDMETHODCALLTYPE SetCurrentLength(DWORD cbCurrentLength) override {
+        if (cbCurrentLength > contiguous_.total)
+            return E_INVALIDARG;
+        len_ = cbCurrentLength;
+        return S_OK;
+    }
+
+    HRESULT STDMETHODCALLTYPE GetMaxLength(_Out_  DWORD *pcbMaxLength) override {
+        *pcbMaxLength = (DWORD)contiguous_.total;
+        return S_OK;
+    }
+
+    HRESULT STDMETHODCALLTYPE Lock2D(BYTE **pbScanline0, LONG *plPitch) override {
+        return GetScanline0AndPitch(pbScanline0, plPitch);
+    }
+
+    HRESULT STDMETHODCALLTYPE Unlock2D() override {return S_OK;}
+
+    HRESULT STDMETHODCALLTYPE GetScanline0AndPitch(BYTE **pbScanline0, LONG *plPitch) override {
+        *pbScanline0 = data_ + layout_.offset[0];
+        *plPitch = layout_.pitch[0];
+        return S_OK;
+    }
+
+    HRESULT STDMETHODCALLTYPE IsContiguousFormat(BOOL *pfIsContiguous) override {
+        *pfIsContiguous = isContiguous();
+        return S_OK;
+    }
+
+    HRESULT STDMETHODCALLTYPE GetContiguousLength(DWORD *pcbLength) override {
+        *pcbLength = (DWORD)contiguous_.total;
+        return S_OK;
+    }
+
+    HRESULT STDMETHODCALLTYPE ContiguousCopyTo(BYTE *pbDestBuffer, DWORD cbDestBuffer) override {
+        if (cbDestBuffer < contiguous_.total)
+            return E_INVALIDARG;
+        copy_planes(layout_, data_, contiguous_, pbDestBuffer);
+        return S_OK;
+    }
+
+    HRESULT STDMETHODCALLTYPE ContiguousCopyFrom(const BYTE *pbSrcBuffer, DWORD cbSrcBuffer) override {
+        if (cbSrcBuffer < contiguous_.total)
+            return E_INVALIDARG;
+        copy_planes(contiguous_, pbSrcBuffer, layout_, data_);
+        return S_OK;
+    }
+};
+
+ComPtr<IMFMediaBuffer> create_external_buffer(const OutputAllocator* allocator, DWORD size, DWORD align, const PlaneLayout* layout)
+{
+    PlaneLayout pitched;
+    PlaneLayout contiguous;
+    if (layout && layout->planes > 0 && layout->pitch[0] > 0) {
+        const VideoFormat fmt(layout->format);
+        contiguous = plane_layout(fmt, layout->width, layout->height, 0);
+        int pitch = allocator->pitch ? (int)allocator->pitch(allocator->opaque, (uint32_t)contiguous.pitch[0]) : 0;
+        if (pitch != 0 && (pitch < contiguous.pitch[0] || (pitch & 15))) {
+            std::clog << "invalid output pitch from application: " << pitch << std::endl;
+            pitch = 0;
+        }
+        pitched = plane_layout(fmt, layout->width, layout->height, pitch > 0 ? pitch : layout->pitch[0]);
+        pitched.format = contiguous.format = layout->format;
+        size = (DWORD)std::max<uint64_t>(pitched.total, (uint64_t)size * pitched.pitch[0] / layout->pitch[0]); // transform may require more rows
+    }
+    void* cookie = nullptr;
+    auto data = allocator->acquire(allocator->opaque, size, align, &cookie);
+    if (!data)
+        return nullptr;
+    if ((intptr_t)data & (align - 1)) {
+        std::clog << "unaligned output buffer from application" << std::endl;
+        allocator->release(allocator->opaque, cookie);
+        return nullptr;
+    }
+    if (pitched.planes > 0)
+        return make_com<MFExternalBuffer2D>(allocator, data, cookie, pitched, contiguous);
+    return make_com<MFExternalBuffer>(allocator, data, size, cookie);
+}
+
+ComPtr<IMFMediaBuffer> create_numa_buffer(DWORD size, int node)
+{
+#if (MS_API_DESKTOP+0)
+    auto b = make_com<MFNumaBuffer>(size, node);
+    if (b && b->isValid())
+        return b;
+#endif
+    return nullptr;
+}
+
+ComPtr<IMFMediaBuffer> from(BufferRef buf, int align, bool* copied)
 {
     ComPtr<IMFMediaBuffer> b;
     const auto a = std::max<int>(align, 16);
-#if (_MSC_VER + 0) // RuntimeClass is missing in mingw
+    if (copied)
+        *copied = false;
     if (((intptr_t)buf->constData() & (a-1)) == 0)
-        return Make<MFMediaBufferView>(buf);
-#endif
+        return make_com<MFMediaBufferView>(buf);
+    if (copied)
+        *copied = true;
     MS_ENSURE(MFCreateAlignedMemoryBuffer((DWORD)buf->size(), a - 1, &b), nullptr);
     BYTE* ptr = nullptr;
     MS_ENSURE(b->Lock(&ptr, nullptr, nullptr), nullptr);
@@ -184,13 +419,18 @@ ComPtr<IMF2DBuffer> from(Buffer2DRef buf)
 
 // TODO: IMFAttributes
 //IMFSample::SetSampleTime method: 100-nanosecond
-ComPtr<IMFSample> from(const Packet& pkt, int align)
+ComPtr<IMFSample> from(const Packet& pkt, int align, bool* copied)
 {
     if (!pkt)
         return nullptr;
+    return from(pkt, from(pkt.buffer, align, copied));
+}
+
+ComPtr<IMFSample> from(const Packet& pkt, ComPtr<IMFMediaBuffer> buf)
+{
     ComPtr<IMFSample> p;
     MS_ENSURE(MFCreateSample(&p), nullptr);
-    MS_ENSURE(p->AddBuffer(from(pkt.buffer, align).Get()), nullptr); // take the ownership. E_INVALIDARG: AddBuffer(nullptr)
+    MS_ENSURE(p->AddBuffer(buf.Get()), nullptr); // take the ownership. E_INVALIDARG: AddBuffer(nullptr)
     p->SetSampleTime(to_mf_time(pkt.pts));
     if (pkt.duration > 0)
         p->SetSampleDuration(to_mf_time(pkt.duration)); // MF_E_NO_SAMPLE_DURATION in GetSampleDuration() if not called
@@ -13,6 +13,7 @@
 #include <mfidl.h>
 #include "MSUtils.h"
 #include "MFCompat.h"
+#include "PlaneLayout.h"
 MDK_NS_BEGIN
 
 class Buffer;
@@ -36,9 +37,27 @@ std::shared_ptr<Buffer> to(ComPtr<IMFMediaBuffer> b, ptrdiff_t offset = 0, int s
 std::shared_ptr<Buffer2D> to(ComPtr<IMF2DBuffer> b, ptrdiff_t offset = 0, int size = -1);
 
 // assum from/to source and target are not the same internal type(mem, mf, av buffer)
-// TODO: no mem allocation if alignment matches
-ComPtr<IMFMediaBuffer> from(std::shared_ptr<Buffer> buf, int align = 0);
+// no copy if buf data is aligned(and supported by toolchain), otherwise *copied is set to true
+ComPtr<IMFMediaBuffer> from(std::shared_ptr<Buffer> buf, int align = 0, bool* copied = nullptr);
 ComPtr<IMF2DBuffer> from(std::shared_ptr<Buffer2D> buf);
+// like MFCreateAlignedMemoryBuffer, but memory is allocated on numa node. returns null if not supported
+ComPtr<IMFMediaBuffer> create_numa_buffer(DWORD size, int node);
+
+// destination memory provided by application, e.g. persistently mapped gpu upload buffers or shared memory. software transforms decode into it directly
+// data layout is the output type's(frame format and strides), or the pitch from allocator for video
+struct OutputAllocator {
+    void* opaque;
+    // returns a buffer of at least size bytes aligned to align, or null to use decoder's memory. *cookie is passed to release
+    uint8_t* (*acquire)(void* opaque, uint32_t size, uint32_t align, void** cookie);
+    // the buffer is no longer used by decoder and frames
+    void (*release)(void* opaque, void* cookie);
+    // optional, can be null. video row pitch of the 1st plane in bytes, >= bytes and 16 bytes aligned, e.g. pitch of gpu upload buffers. other planes are in the output type's layout with this pitch,
+    // e.g. the same pitch for nv12 chroma, half for yuv420p chroma. returns 0 to use the output type's stride
+    uint32_t (*pitch)(void* opaque, uint32_t bytes);
+};
+// a buffer of memory from allocator, which is released when the buffer is destroyed. returns null if allocator has no buffer
+// layout: video output type layout. the buffer is an IMF2DBuffer in the layout with allocator's pitch if not null
+ComPtr<IMFMediaBuffer> create_external_buffer(const OutputAllocator* allocator, DWORD size, DWORD align, const PlaneLayout* layout = nullptr);
 
 static inline LONGLONG to_mf_time(double s)
 {
@@ -50,7 +69,9 @@ static inline double from_mf_time(LONGLONG ns_100)
     return ns_100/100000000.0;
 }
 
-ComPtr<IMFSample> from(const Packet& pkt, int align = 0);
+ComPtr<IMFSample> from(const Packet& pkt, int align = 0, bool* copied = nullptr);
+// sample of packet time and flags, with buf instead of packet buffer
+ComPtr<IMFSample> from(const Packet& pkt, ComPtr<IMFMediaBuffer> buf);
 void to(Packet& pkt, ComPtr<IMFSample> mfpkt);
 
 const CLSID* codec_for(const std::string& name, MediaType type);
@@ -75,12 +96,21 @@ bool from(const HDRMetadata& hdr, IMFAttributes* a);
 bool to(VideoFormat& fmt, const IMFAttributes* a);
 bool from(const VideoFormat& fmt, IMFAttributes* a);
 
+// from subtype, MF_MT_FRAME_SIZE and MF_MT_DEFAULT_STRIDE
+bool to(PlaneLayout& layout, const IMFAttributes* a);
+// number of sample buffers locked to access frame planes in the process. software decoder buffers are locked on 1st plane access if not copied
+uint64_t buffer_locks();
+// whether planes of format from can be copied and converted to format to in 1 pass, e.g. nv12 => yuv420p
+bool can_convert(const VideoFormat& from, const VideoFormat& to);
+
 // frame format and size are not touched(no corresponding attributes in sample)
 // \param copy
 // 0: no copy if possible, i.e. hold d3d surface for d3d buffer, or add ref to sample buffers and lock to access for software decoder sample buffers(no d3d).
 // 1: lock sample buffer for d3d, and also copy data to frame planes for software decoder sample buffers
-// 2: lock sample buffer copy data to frame planes for d3d
-bool to(VideoFrame& frame, ComPtr<IMFSample> sample, int strideX = 0, int strideY = 0, int copy = 0);
+// 2: lock sample buffer copy data to frame planes for d3d. mapped surfaces are read by streaming loads(sse4.1) if supported
+// if frame format is not layout.format, planes are always copied and converted, see can_convert()
+// \param threads if > 1, copied planes are split into row bands and copied by a shared worker pool concurrently. returns after all bands are copied
+bool to(VideoFrame& frame, ComPtr<IMFSample> sample, const PlaneLayout& layout, int copy = 0, int threads = 1);
 bool from(const VideoFrame& frame, ComPtr<IMFSample> sample);
 /*
 bool to(AudioFrame& frame, ComPtr<IMFMediaType> mfmt);
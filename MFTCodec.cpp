@@ -20,7 +20,9 @@
 #include "base/mpsc_fifo.h"
 #include "mdk/Property.h"
 #include <algorithm>
+#include <atomic>
 #include <codecapi.h>
+#include <strmif.h> // ICodecAPI
 #if __has_include(<Mferror.h>) // msvc
 # include <Mferror.h>
 # include <Mftransform.h> // MFT_FRIENDLY_NAME_Attribute
@@ -33,12 +35,15 @@ using namespace std;
 
 // TODO: async. see vlc
 // properties: activate=(index 0, 1, ...), pool=1(0, 1), in_type=index(or -1), out_type=index(or -1)
+// output_allocator=0: address of MF::OutputAllocator(decimal or 0x hex). software decoders write into application memory, which is reused via the sample pool
 // codec attributes: https://docs.microsoft.com/zh-cn/windows/win32/directshow/codec-api-properties
 
 MDK_NS_BEGIN
-#if (_MSC_VER + 0) // RuntimeClass is missing in mingw
+// output type generation of pool sample buffers
+static const GUID kPoolGeneration = { 0x6b7c9e1a, 0x3f2d, 0x4c8e, { 0x9a, 0x51, 0x2e, 0x7d, 0x40, 0x18, 0xc3, 0x5f } };
+
 // used by SetAllocator, pool ref must be added in Tracked sample, so make it as IUnknown
-class MFTCodec::SamplePool final : public mpsc_fifo<ComPtr<IMFTrackedSample>>, public RuntimeClass<RuntimeClassFlags<ClassicCom>, IMFAsyncCallback>  // IUnknown is implemented by RuntimeClass
+class MFTCodec::SamplePool final : public mpsc_fifo<ComPtr<IMFTrackedSample>>, public ComBase<IMFAsyncCallback>
 {
 public:
     HRESULT STDMETHODCALLTYPE GetParameters(DWORD *pdwFlags, DWORD *pdwQueue) override {return E_NOTIMPL;}
@@ -46,23 +51,64 @@ public:
         IMFTrackedSample* s = nullptr;
         HRESULT hr = S_OK;
         MS_ENSURE((hr = pAsyncResult->GetState((IUnknown**)&s)), hr);
+        const auto limit = limit_.load();
+        if (limit > 0 && idle_ >= limit) { // e.g. frames held by ring are released
+            s->Release();
+            return hr;
+        }
+        idle_++;
         push(std::move(s));
         return hr;
     }
+
+    void setLimit(int value) { limit_ = value; }
+    bool take(ComPtr<IMFTrackedSample>* s) {
+        if (!pop(s))
+            return false;
+        idle_--;
+        return true;
+    }
+    void clear() {
+        mpsc_fifo<ComPtr<IMFTrackedSample>>::clear();
+        idle_ = 0;
+    }
+private:
+    std::atomic<int> limit_{0};
+    std::atomic<int> idle_{0};
 };
-#endif
+
 MFTCodec::MFTCodec()
 {
-#if (_MSC_VER + 0)
-    pool_cb_ = Make<SamplePool>();
-#endif
+    pool_cb_ = make_com<SamplePool>();
 }
 
-MFTCodec::~MFTCodec() = default;
+void MFTCodec::setOutputLayout(const MF::PlaneLayout& value)
+{
+    out_layout_ = value;
+    getPool()->clear();
+    pool_gen_++;
+}
+
+void MFTCodec::setSamplePoolLimit(int value)
+{
+    getPool()->setLimit(value);
+}
+
+MFTCodec::SamplePool* MFTCodec::getPool()
+{
+    return static_cast<SamplePool*>(pool_cb_.Get()); // IMFAsyncCallback is not the 1st base
+}
+
+MFTCodec::~MFTCodec()
+{
+    if (mft_) // kept by derived class
+        destroyMFT();
+}
 
 bool MFTCodec::openCodec(MediaType mt, const CLSID& codec_id, const Property* prop)
 {
     useSamplePool(std::stoi(prop->get("pool", "1")));
+    setOutputAllocator((const MF::OutputAllocator*)(intptr_t)std::stoull(prop->get("output_allocator", "0"), nullptr, 0));
     activateAt(std::stoi(prop->get("activate", "0")));
     setInputTypeIndex(std::stoi(prop->get("in_type", "-1")));
     setOutputTypeIndex(std::stoi(prop->get("out_type", "-1")));
@@ -91,6 +137,20 @@ bool MFTCodec::openCodec(MediaType mt, const CLSID& codec_id, const Property* pr
     MS_ENSURE(mft_->GetOutputCurrentType(id_out_, &type), false);
     if (!onOutputTypeChanged(id_out_, type))
         return false;
+    if (SUCCEEDED(mft_.As(&qa_))) {
+        mft_.As(&qa2_); // win7+
+        ComPtr<IMFAttributes> a;
+        UINT32 custom = 0;
+        if (SUCCEEDED(mft_->GetAttributes(&a)))
+            a->GetUINT32(MFT_DECODER_QUALITY_MANAGEMENT_CUSTOM_CONTROL, &custom);
+        clog << "IMFQualityAdvise is supported. IMFQualityAdvise2: " << !!qa2_ << ", custom quality control: " << custom << endl;
+    }
+    drop_mode_ = MF_DROP_MODE_NONE;
+    pending_.clear();
+    pts_.clear();
+    inputs_.clear();
+    resetCounters();
+    last_pts_ = -1;
     // TODO: apply extra data here?
     MS_ENSURE(mft_->ProcessMessage(MFT_MESSAGE_NOTIFY_BEGIN_STREAMING, ULONG_PTR()), false); // optional(After setting all media types, before ProcessInput). allocate resources(in the 1st ProcessInput if not sent).
     MS_ENSURE(mft_->ProcessMessage(MFT_MESSAGE_NOTIFY_START_OF_STREAM, ULONG_PTR()), false); // required by async. start to process inputs
@@ -100,10 +160,154 @@ bool MFTCodec::openCodec(MediaType mt, const CLSID& codec_id, const Property* pr
 
 bool MFTCodec::closeCodec()
 {
+    if (track_frames_)
+        clog << fmt::to_string("frames decoded: %llu, dropped: %llu", decoded_, dropped_) << endl;
+    if (recoveries_ > 0)
+        clog << fmt::to_string("error recoveries: %llu, discarded packets: %llu", recoveries_, discarded_) << endl;
+    clog << fmt::to_string("input packets zero copy: %llu, copied: %llu", zero_copy_in_, copied_in_) << endl;
+    qa2_.Reset();
+    qa_.Reset();
     destroyMFT();
     return true;
 }
 
+void MFTCodec::resetCounters()
+{
+    decoded_ = dropped_ = 0;
+    recovering_ = false;
+    recoveries_ = discarded_ = 0;
+    zero_copy_in_ = copied_in_ = 0;
+}
+
+bool MFTCodec::setCodecValue(const GUID& api, UINT32 value)
+{
+    if (!mft_)
+        return false;
+    ComPtr<ICodecAPI> codec;
+    if (SUCCEEDED(mft_.As(&codec))) {
+        if (codec->IsSupported(&api) != S_OK || codec->IsModifiable(&api) != S_OK)
+            return false;
+        VARIANT v{};
+        v.vt = VT_UI4;
+        v.ulVal = value;
+        HRESULT hr = S_OK;
+        MS_WARN((hr = codec->SetValue(&api, &v)));
+        if (SUCCEEDED(hr))
+            return true;
+    }
+    ComPtr<IMFAttributes> a;
+    MS_ENSURE(mft_->GetAttributes(&a), false);
+    MS_ENSURE(a->SetUINT32(api, value), false);
+    return true;
+}
+
+bool MFTCodec::setLateness(double seconds)
+{
+    if (!qa_)
+        return false;
+    if (qa2_) { // let the transform decide how to drop
+        ComPtr<IMFMediaEvent> e;
+        MS_ENSURE(MFCreateMediaEvent(MEQualityNotify, GUID_NULL, S_OK, nullptr, &e), false);
+        MS_ENSURE(e->SetUINT64(MF_QUALITY_NOTIFY_SAMPLE_LAG, (UINT64)std::max<LONGLONG>(0, MF::to_mf_time(seconds))), false);
+        DWORD flags = 0;
+        if (SUCCEEDED(qa2_->NotifyQualityEvent(e.Get(), &flags))) {
+            MF_QUALITY_DROP_MODE mode = MF_DROP_MODE_NONE;
+            if (SUCCEEDED(qa_->GetDropMode(&mode)) && mode != drop_mode_)
+                clog << "MFT drop mode: " << mode << endl;
+            drop_mode_ = mode;
+            return true;
+        }
+    }
+    static const double kLateness[] = {0, 0.1, 0.2, 0.5, 1.0}; // lateness to enter MF_DROP_MODE_1~5
+    auto mode = MF_DROP_MODE_NONE;
+    while (mode < (MF_QUALITY_DROP_MODE)std::size(kLateness) && seconds > kLateness[mode])
+        mode = (MF_QUALITY_DROP_MODE)(mode + 1);
+    if (mode == drop_mode_)
+        return true;
+    HRESULT hr = S_OK;
+    while ((hr = qa_->SetDropMode(mode)) == MF_E_NO_MORE_DROP_MODES && mode > MF_DROP_MODE_NONE) // the highest mode is not supported
+        mode = (MF_QUALITY_DROP_MODE)(mode - 1);
+    MS_ENSURE(hr, false);
+    clog << "MFT drop mode: " << mode << ", lateness: " << seconds << endl;
+    drop_mode_ = mode;
+    return true;
+}
+
+void MFTCodec::startRecovery()
+{
+    if (recovering_)
+        return;
+    clog << "discard input until next key frame" << endl;
+    recovering_ = true;
+    recoveries_++;
+}
+
+// packets after a gap reference missing pictures
+void MFTCodec::checkGap(const Packet& pkt)
+{
+    if (!pkt.hasKeyFrame && last_pts_ >= 0 && pkt.pts - last_pts_ > std::max<double>(1.0, 8 * pkt.duration))
+        startRecovery();
+    last_pts_ = pkt.pts;
+}
+
+void MFTCodec::onPacketSkipped(const Packet& pkt)
+{
+    if (recover_)
+        checkGap(pkt);
+}
+
+void MFTCodec::onInputTime(LONGLONG t)
+{
+    if (reorder_pts_) {
+        if ((int)pts_.size() >= pts_depth_) // the transform never outputs them
+            pts_.erase(pts_.begin());
+        pts_.insert(std::upper_bound(pts_.begin(), pts_.end(), t), t);
+        if ((int)inputs_.size() >= 2 * pts_depth_)
+            inputs_.erase(inputs_.begin());
+        inputs_.push_back({t, input_seq_++});
+    }
+    if (!track_frames_ || reorder_pts_)
+        return;
+    if (pending_.size() >= 64) // bad timestamps, or the transform never outputs them
+        pending_.erase(pending_.begin());
+    pending_.insert(std::upper_bound(pending_.begin(), pending_.end(), t), t);
+}
+
+// outputs are in presentation order. if timestamps are reordered, outputs can be in decode order and drops are counted by onReorderedTime()
+void MFTCodec::onOutputTime(LONGLONG t)
+{
+    if (!track_frames_)
+        return;
+    decoded_++;
+    if (reorder_pts_)
+        return;
+    dropped_ += std::distance(pending_.begin(), std::lower_bound(pending_.begin(), pending_.end(), t));
+    pending_.erase(pending_.begin(), std::upper_bound(pending_.begin(), pending_.end(), t));
+}
+
+// the transform keeps input time of a frame, but the order can be wrong. inputs decoded and presented before the frame and not out are dropped,
+// their time must not be assigned to later frames
+void MFTCodec::onReorderedTime(LONGLONG t)
+{
+    const auto it = std::find_if(inputs_.cbegin(), inputs_.cend(), [t](const InputTime& i) { return i.t == t; });
+    if (it == inputs_.cend()) // not an input time
+        return;
+    const auto seq = it->seq;
+    auto dropped = [=](const InputTime& i) { return i.seq < seq && i.t < t; };
+    for (const auto& i : inputs_) {
+        if (!dropped(i))
+            continue;
+        if (track_frames_)
+            dropped_++;
+        const auto p = std::lower_bound(pts_.begin(), pts_.end(), i.t);
+        if (p != pts_.end() && *p == i.t)
+            pts_.erase(p);
+        else if (!pts_.empty()) // assigned to an earlier output instead of its own time
+            pts_.erase(pts_.begin());
+    }
+    inputs_.erase(std::remove_if(inputs_.begin(), inputs_.end(), [=](const InputTime& i) { return i.seq == seq || dropped(i); }), inputs_.end());
+}
+
 bool MFTCodec::createMFT(MediaType mt, const CLSID& codec_id)
 {
     uninit_com_ = CoInitializeEx(nullptr, COINIT_MULTITHREADED) != RPC_E_CHANGED_MODE; // TODO: class
@@ -377,11 +581,22 @@ bool MFTCodec::flushCodec()
 { // https://docs.microsoft.com/zh-cn/windows/desktop/medfound/basic-mft-processing-model#flushing-an-mft
     MS_ENSURE(mft_->ProcessMessage(MFT_MESSAGE_COMMAND_FLUSH, ULONG_PTR()), false);
     discontinuity_ = true; // TODO:
+    pending_.clear();
+    pts_.clear();
+    inputs_.clear();
+    last_pts_ = -1;
     // TODO: async mft does not send another METransformNeedInput event until it receives an MFT_MESSAGE_NOTIFY_START_OF_STREAM message from the client
     // https://docs.microsoft.com/zh-cn/windows/desktop/medfound/mft-message-command-flush
     return true;
 }
 
+bool MFTCodec::drainCodec()
+{
+    MS_ENSURE(mft_->ProcessMessage(MFT_MESSAGE_COMMAND_DRAIN, ULONG_PTR()), false);
+    while (processOutput()) {}
+    return true;
+}
+
 bool MFTCodec::decodePacket(const Packet& pkt)
 {
     if (pkt.isEnd()) {
@@ -392,11 +607,45 @@ bool MFTCodec::decodePacket(const Packet& pkt)
         while (processOutput()) {}
         return false;
     }
-    size_t size = pkt.buffer->size();
+    if (recover_) {
+        checkGap(pkt);
+        if (recovering_) {
+            if (!pkt.hasKeyFrame) {
+                discarded_++;
+                return true;
+            }
+            recovering_ = false;
+            MS_WARN(mft_->ProcessMessage(MFT_MESSAGE_COMMAND_FLUSH, ULONG_PTR())); // drop broken state and pending outputs
+            discontinuity_ = true;
+            pending_.clear();
+            pts_.clear();
+            inputs_.clear();
+            onRecovered();
+        }
+    }
+    const size_t size = pkt.buffer ? pkt.buffer->size() : 0;
     Packet filtered = pkt;
-    if (pkt.buffer && pkt.buffer->constData())
-        filtered.buffer = filter(pkt.buffer);
-    ComPtr<IMFSample> sample = MF::from(filtered, info_in_.cbAlignment);
+    ComPtr<IMFSample> sample;
+    const auto data = pkt.buffer ? pkt.buffer->constData() : nullptr;
+    const int filtered_size = data ? filter(data, (int)size, nullptr) : -1;
+    if (filtered_size >= 0) { // 1 copy from packet to input buffer, packet is untouched
+        ComPtr<IMFMediaBuffer> buf;
+        MS_ENSURE(MFCreateAlignedMemoryBuffer((DWORD)filtered_size, inputAlignment() - 1, &buf), false);
+        BYTE* ptr = nullptr;
+        MS_ENSURE(buf->Lock(&ptr, nullptr, nullptr), false);
+        const int written = filter(data, (int)size, ptr);
+        buf->Unlock();
+        MS_ENSURE(buf->SetCurrentLength((DWORD)written), false);
+        sample = MF::from(pkt, buf);
+        copied_in_++;
+    } else {
+        if (data)
+            filtered.buffer = filter(pkt.buffer);
+        bool copied = false;
+        sample = MF::from(filtered, inputAlignment(), &copied);
+        if (data)
+            (copied ? copied_in_ : zero_copy_in_)++;
+    }
     if (!sample)
         return false;
     if (discontinuity_) {
@@ -406,12 +655,17 @@ bool MFTCodec::decodePacket(const Packet& pkt)
             attr->SetUINT32(MFSampleExtension_Discontinuity, 1);
     }
     auto hr = mft_->ProcessInput(id_in_, sample.Get(), 0);
+    if (SUCCEEDED(hr))
+        onInputTime(MF::to_mf_time(filtered.pts));
     if (hr == MF_E_NOTACCEPTING) { // MUST be in 1 state: accept more input, produce more output
         while (processOutput()) {}
         MS_ENSURE(mft_->ProcessInput(id_in_, sample.Get(), 0), false);
+        onInputTime(MF::to_mf_time(filtered.pts));
     } else if (FAILED(hr)) { // MFT can drop it
         std::clog << "ProcessInput error: " << hr << std::endl;
         discontinuity_ = true;
+        if (recover_)
+            startRecovery();
         MS_ENSURE(hr, false);
         return true;
     }
@@ -427,8 +681,14 @@ ComPtr<IMFSample> MFTCodec::getOutSample() // getUncompressedSample()
     auto set_sample_buffers = [this](IMFSample* sample){
         ComPtr<IMFMediaBuffer> buf;
         const auto align = std::max<int>(16, info_out_.cbAlignment);
-        MS_ENSURE(MFCreateAlignedMemoryBuffer(info_out_.cbSize, align - 1, &buf));
+        if (allocator_)
+            buf = MF::create_external_buffer(allocator_, info_out_.cbSize, align, out_layout_.planes > 0 ? &out_layout_ : nullptr);
+        if (!buf && numa_node_ >= 0 && align <= 4096) // page aligned
+            buf = MF::create_numa_buffer(info_out_.cbSize, numa_node_);
+        if (!buf)
+            MS_ENSURE(MFCreateAlignedMemoryBuffer(info_out_.cbSize, align - 1, &buf));
         sample->AddBuffer(buf.Get());
+        sample->SetUINT32(kPoolGeneration, pool_gen_);
     };
     ComPtr<IMFSample> sample;
 #if !(MS_WINRT+0)
@@ -445,9 +705,13 @@ ComPtr<IMFSample> MFTCodec::getOutSample() // getUncompressedSample()
         set_sample_buffers(sample.Get());
         return sample;
     }
-#if (_MSC_VER + 0)
     ComPtr<IMFTrackedSample> ts;
-    if (!getPool()->pop(&ts)) {
+    UINT32 gen = 0;
+    if (getPool()->take(&ts) && (FAILED(ts.As(&sample)) || FAILED(sample->GetUINT32(kPoolGeneration, &gen)) || gen != pool_gen_)) { // held by frames when output type changed
+        sample.Reset();
+        ts.Reset(); // application buffers are released
+    }
+    if (!ts) {
         std::clog << this << " no sample in pool. create one" << std::endl;
         MS_ENSURE(MFCreateTrackedSample(&ts), nullptr);
         MS_ENSURE(ts.As(&sample), nullptr);
@@ -455,7 +719,6 @@ ComPtr<IMFSample> MFTCodec::getOutSample() // getUncompressedSample()
     }
     ts->SetAllocator(pool_cb_.Get(), ts.Get()); // callback is cleared after invoke()
     MS_ENSURE(ts.As(&sample), nullptr);
-#endif // (_MSC_VER + 0)
     return sample;
 }
 
@@ -507,9 +770,8 @@ bool MFTCodec::processOutput()
     if (hr == MF_E_TRANSFORM_STREAM_CHANGE) { // TODO: status == MFT_PROCESS_OUTPUT_STATUS_NEW_STREAMS?
         std::clog << "MF_E_TRANSFORM_STREAM_CHANGE" << std::endl;
         sample.Reset(); // recycle if tracked
-#if (_MSC_VER + 0)
-        getPool()->clear(); // different buffer parameters. FIXME: how to clear all samples outside the pool? double pool and swap?
-#endif
+        getPool()->clear(); // different buffer parameters.
+        pool_gen_++; // FIXME: how to clear all samples outside the pool? double pool and swap?
         // TODO: GetStreamIDs() again? https://docs.microsoft.com/zh-cn/windows/desktop/api/mftransform/ne-mftransform-_mft_process_output_status
         bool later = false;
         if (!selectOutputType(id_out_, &later))
@@ -534,6 +796,15 @@ bool MFTCodec::processOutput()
         clog << "null output sample" << endl;
         return true;
     }
+    LONGLONG t = 0;
+    if (track_frames_ && SUCCEEDED(sample->GetSampleTime(&t)))
+        onOutputTime(t);
+    if (reorder_pts_ && SUCCEEDED(sample->GetSampleTime(&t)))
+        onReorderedTime(t);
+    if (reorder_pts_ && !pts_.empty()) { // frames are out in presentation order, so is the sorted input time
+        MS_WARN(sample->SetSampleTime(pts_.front()));
+        pts_.erase(pts_.begin());
+    }
     return onOutput(sample);
 }
 MDK_NS_END
\ No newline at end of file
@@ -10,7 +10,9 @@
 #pragma once
 #include "mdk/Packet.h"
 #include "MFGlue.h"
+#include <algorithm>
 #include <iostream>
+#include <vector>
 
 MDK_NS_BEGIN
 class MDK_NOVTBL MFTCodec
@@ -20,10 +22,20 @@ protected:
     virtual ~MFTCodec();
     // enable (unbounded) sample pool. Use a pool to reduce sample and buffer allocation frequency because a buffer(video) can be in large size.
     void useSamplePool(bool value = true) { use_pool_ = value; } // setPoolSamples(int size = -1)
+    // max idle samples kept in pool, samples returned later are released. 0: unlimited
+    void setSamplePoolLimit(int value);
     void activateAt(int value) { activate_index_ = value; }
+    // allocate output samples of software decoder on numa node. -1: default
+    void setNumaNode(int value) { numa_node_ = value; }
+    // software decoder writes into application memory if possible. allocator must be alive until all frames are released
+    void setOutputAllocator(const MF::OutputAllocator* value) { allocator_ = value; }
+    // video only. plane layout of output type, for buffers from output allocator. pool samples of the old layout are not reused
+    void setOutputLayout(const MF::PlaneLayout& value);
     bool openCodec(MediaType type, const CLSID& codec_id, const Property* prop);
     bool closeCodec();
     bool flushCodec();
+    // output all pending frames, e.g. before a stream change
+    bool drainCodec();
     bool decodePacket(const Packet& pkt);
     void setInputTypeIndex(int index = -1) {
         in_type_idx_ = index;
@@ -31,6 +43,38 @@ protected:
     void setOutputTypeIndex(int index = -1) {
         out_type_idx_ = index;
     }
+    // apply a codec api property to the created transform, via ICodecAPI if supported, otherwise transform attributes
+    // return false if rejected by ICodecAPI
+    bool setCodecValue(const GUID& api, UINT32 value);
+    // renderer lateness in seconds. > 0: frames are dropped by the transform via IMFQualityAdvise(2), the later the more frames. <= 0: no drop
+    bool setLateness(double seconds);
+    // video only. frames not out but followed by an output with larger time are dropped by the transform
+    // with reorderTimestamps(), frames not out but followed by an output of a later input with larger time
+    void trackFrames(bool value = true) { track_frames_ = value; }
+    // video only. output sample time is replaced by the smallest input time not used yet, for transforms output frames without reordering(low latency mode)
+    // time of inputs dropped by the transform is removed when a later input is out, matched by output sample time
+    // depth: max number of frames buffered by the transform
+    void reorderTimestamps(bool value = true, int depth = 32) {
+        reorder_pts_ = value;
+        pts_depth_ = depth;
+    }
+    // frame, recovery and input counters, e.g. for a new stream on a reused transform. called by openCodec()
+    void resetCounters();
+    uint64_t decodedFrames() const { return decoded_; }
+    uint64_t droppedFrames() const { return dropped_; }
+    // after ProcessInput error or a gap in input pts, discard input until the next key frame, then flush and resume
+    void recoverAtKeyFrame(bool value = true) { recover_ = value; }
+    void startRecovery();
+    // a packet dropped before decodePacket(), e.g. a disposable frame. its time is used by gap detection, so skipping is not a gap
+    void onPacketSkipped(const Packet& pkt);
+    uint64_t recoveries() const { return recoveries_; }
+    uint64_t discardedPackets() const { return discarded_; }
+    // input buffer requirements of the transform. packets satisfying them are used without copy. valid after openCodec()
+    int inputAlignment() const { return std::max<int>(16, info_in_.cbAlignment); }
+    int inputPadding() const { return (int)info_in_.cbMaxLookahead; }
+    // input packets used directly or copied(including filtered)
+    uint64_t zeroCopyInputs() const { return zero_copy_in_; }
+    uint64_t copiedInputs() const { return copied_in_; }
 private:
     bool createMFT(MediaType type, const CLSID& codec_id);
     virtual bool onMFTCreated(ComPtr<IMFTransform> /*mft*/) {return true;}
@@ -39,6 +83,12 @@ private:
     // bitstream/packet filter
     // return nullptr if filter in place, otherwise allocated data is returned and size is modified. no need to free the data
     virtual BufferRef filter(BufferRef in) {return in;}
+    // filter from packet data into the input media buffer in 1 pass, used instead of filter(BufferRef) if supported
+    // out == nullptr: returns the filtered size. otherwise writes filtered data to out and returns the size
+    // returns -1 if not filtered, then the packet buffer is used directly
+    virtual int filter(const uint8_t* /*data*/, int /*size*/, uint8_t* /*out*/) {return -1;}
+    // recovery from error is done, the transform is flushed and next input is a key frame. e.g. resend parameter sets
+    virtual void onRecovered() {}
     virtual bool setInputTypeAttributes(IMFAttributes*) {return true;}
     virtual bool setOutputTypeAttributes(IMFAttributes*) {return true;}
     virtual int getInputTypeScore(IMFAttributes*) {return -1;}
@@ -48,19 +98,32 @@ private:
     ComPtr<IMFSample> getOutSample(); // get an output sample from pool, or create directly.
     // processInput(data, size);
     bool processOutput();
+    void onInputTime(LONGLONG t);
+    void onOutputTime(LONGLONG t);
+    void onReorderedTime(LONGLONG t);
+    void checkGap(const Packet& pkt);
     virtual ComPtr<IMFMediaType> selectInputType(DWORD stream_id, bool* later);
     virtual ComPtr<IMFMediaType> selectOutputType(DWORD stream_id, bool* later);
 protected:
     ComPtr<IMFTransform> mft_;
 private:
     class SamplePool;
-    SamplePool* getPool() {return reinterpret_cast<SamplePool*>(pool_cb_.Get());}
+    SamplePool* getPool();
 
     bool uninit_com_ = false;
     bool use_pool_ = true;
     bool discontinuity_ = false;
     bool warn_not_tracked_ = true;
+    bool track_frames_ = false;
+    bool reorder_pts_ = false;
+    bool recover_ = false;
+    bool recovering_ = false;
+    int pts_depth_ = 32;
     int activate_index_ = -1;
+    int numa_node_ = -1;
+    const MF::OutputAllocator* allocator_ = nullptr;
+    MF::PlaneLayout out_layout_;
+    UINT32 pool_gen_ = 0;
     DWORD id_in_ = 0;
     DWORD id_out_ = 0;
     MFT_INPUT_STREAM_INFO info_in_;
@@ -68,6 +131,25 @@ private:
     int in_type_idx_ = -1;
     int out_type_idx_ = -1;
 
+    ComPtr<IMFQualityAdvise> qa_;
+    ComPtr<IMFQualityAdvise2> qa2_;
+    MF_QUALITY_DROP_MODE drop_mode_ = MF_DROP_MODE_NONE;
+    std::vector<LONGLONG> pending_; // sorted input sample time not out yet
+    std::vector<LONGLONG> pts_; // sorted input sample time to be assigned to outputs
+    struct InputTime {
+        LONGLONG t;
+        uint64_t seq; // input order
+    };
+    std::vector<InputTime> inputs_; // input sample time not seen in outputs, in input order
+    uint64_t input_seq_ = 0;
+    uint64_t decoded_ = 0;
+    uint64_t dropped_ = 0;
+    uint64_t recoveries_ = 0;
+    uint64_t discarded_ = 0;
+    uint64_t zero_copy_in_ = 0;
+    uint64_t copied_in_ = 0;
+    double last_pts_ = -1;
+
     using SamplePoolRef = std::shared_ptr<SamplePool>;
     ComPtr<IMFAsyncCallback> pool_cb_; // double-pool for stream(parameter) change to clear samples outside the pool?
 };
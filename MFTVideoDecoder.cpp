@@ -44,9 +44,12 @@ Compare with FFmpeg D3D11/DXVA:
 #include "mdk/Packet.h"
 #include "mdk/VideoFrame.h"
 #include "NAL.h"
-#include "base/ByteArrayBuffer.h"
+#include "SPSParser.h"
 #include "base/fmt.h"
+#include "base/scope_atexit.h"
+#include "base/ms/MFCaps.h"
 #include "base/ms/MFTCodec.h"
+#include "base/ms/PixelConvert.h"
 #include "video/d3d/D3D9Utils.h"
 #include "video/d3d/D3D11Utils.h"
 #include <codecapi.h>
@@ -55,26 +58,319 @@ Compare with FFmpeg D3D11/DXVA:
 #else // mingw
 # include <mferror.h>
 #endif
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <deque>
+#include <atomic>
 #include <iostream>
+#include <map>
+#include <mutex>
+#include <sstream>
 #include <thread>
+#include <vector>
 //#ifdef _MSC_VER
 # pragma pop_macro("_WIN32_WINNT")
 
 /*
   properties:
   d3d=0(0, 9, 11), copy=0(0, 1, 2), adapter=0, low_latency=0(0,1), ignore_profile=0(0,1), ignore_level=0(0,1)
+  format=unknown: preferred output format, e.g. nv12, p010le, yuyv422. if the transform can not output it and copy > 0, frames are copied and converted in 1 pass if supported: nv12 => yuv420p, p010le => yuv420p10le, yuyv422 => yuv422p. simd code is selected at runtime
+  ignore_profile also disables chroma format, bit depth and profile checks of h264/hevc/vp9/av1 parameter sets or codec configuration records(hvcC, vpcC, av1C)
+  trust_pts=0(0,1): in low latency mode, use output time of the transform instead of sorted input pts
   shader_resource=0(0,1),shared=1, nthandle=0, kmt=0
   feature_level=12.1(9.1,9.2,1.3,10.0,10.1,11.0,11.1,12.0,12.1), blacklist=mpeg4
   software decoder properties:
   priority=-2(lowest), -1(below normal), 0(normal), 1(above normal), 2(highest)
   threads=0(default, number of concurrent threads supported), N
+  thread_budget=0: cores shared by all software decoders with threads=0 in the process, weighted by frame size and priority. 0: disabled, -1: number of concurrent threads supported
   fast=0: normal, 1: Optimal Loop Filter, 2: Disable Loop Filter, ..., 32: fastest
   power=0: Optimize for battery life, 50: balanced, 100: Optimize for video quality. 0~100
   deinterlace=0: no, 1: progressive, 2: bob, 3: smart bob
+  affinity=0: worker thread affinity mask(hex or decimal), 0: default
+  numa_node=-1: run worker threads on processors of the node, and allocate software decoder output samples on the node. -1: default
+  threads, priority, fast, power and deinterlace can be changed on the fly, applied before decoding the next packet. keys accepted by the transform are reported by property "codec.accepted"
+  ring=0: 0: disabled, N: keep at most N decoded frames, -1: keep frames of the last complete gop and the current gop, at most ring_mem / frame size and 32 frames. used to step backward/scrub without decoding again
+  ring_mem=64: memory limit of ring frames in MB
+  frames held by ring are counted in output surfaces requested from d3d11 decoder(copy=0) and in idle samples kept in the software decoder sample pool
+  lateness=0: set by renderer at runtime, in seconds. the transform drops frames via IMFQualityAdvise if > 0, applied before decoding the next packet. decoded and dropped frames are reported by properties "frames.decoded" and "frames.dropped" at key frames
+  skip_nonref=0: h264 and hevc only. 0: decode all frames, 1: drop non-reference frames before decoding, 2: drop non-reference frames if renderer is late
+  max_temporal_id=-1: hevc only. drop frames in temporal sub-layers above the value before decoding, e.g. for reduced frame rate. -1: decode all layers
+  frames dropped before decoding are reported by property "frames.skipped" with "frames.decoded". sample buffers locked in the process to access frame planes are reported by "buffers.locked", which does not increase for frames dropped without accessing planes
+  recover=0(0,1): after decoding error or a gap in input, discard packets until the next key frame and resend parameter sets. reported by properties "recovery.count" and "recovery.discarded"
+  governor=0(0,1): software decoder only. raise fast decode and lower power levels step by step if decoding is slower than stream frame rate, and restore if fast enough. current level is reported by property "governor.level"
+  thumbnail=0(0,1): decode key frames only. the transform is kept after close() and reused by the next open() if codec, size, depth, d3d, copy and format are the same
+  thumbnail_times=t1,t2,...: output 1 frame for each time(in seconds), i.e. the last key frame <= t. all key frames are output if empty
+  copy_threads=0: copy(and convert) large frames in row bands by N threads of a worker pool shared by all decoders, if copy > 0 or planes can not be referenced. 0: disabled, -1: half of concurrent threads supported, at most 4. can be changed on the fly
+  copy_threads_min=16: frame size in MB to use copy_threads. e.g. 4k p010 is 24MB, 8k p010 is 95MB
+  output_allocator=0: software decoder only. address of MF::OutputAllocator, decode into application memory with the pitch from allocator if any. frames reference the memory if copy=0. memory is reused via sample pool, and released to application when the pool drops it or the output type changes
+  input.alignment, input.padding: set by decoder after open. packet data aligned to input.alignment with input.padding bytes readable after the end is used by the transform without copy
+  input.zero_copy, input.copied: set by decoder at key frames. number of packets used without copy or copied(unaligned, or converted to annexb)
+  caps=codec1,codec2,...: query decoder capabilities without open(), e.g. on a decoder created only for the query. blocks until the codecs are probed(once per process), and results are set as property "caps.codec", e.g. "caps.hevc" is "software=1,hardware=1,d3d9=1,d3d11=1,max_width=8192,max_height=4352,max_bit_depth=10". max size is 0 if unknown, and is of the mode in property "d3d" if a transform of the mode was opened. unsupported codecs are not set. caps=probe: probe all codecs in a background thread
   TODO: property device=global
  */
 MDK_NS_BEGIN
 using namespace std;
+
+// decoded frames grouped by gop. a complete gop(all frames are decoded, i.e. a frame of the next gop is out) is replayed if seek target is it's key frame
+class FrameRing
+{
+public:
+    // held: max frames in any mode, 0: unlimited
+    void setLimits(int frames, size_t bytes, int held = 0) {
+        max_frames_ = frames;
+        max_bytes_ = bytes;
+        max_held_ = held;
+        clear();
+    }
+    bool enabled() const { return max_frames_ != 0; }
+    void clear() {
+        gops_.clear();
+        frames_ = 0;
+        bytes_ = 0;
+    }
+    // key frame packet is decoded, frames with pts >= key belong to a new gop
+    void addKey(double pts) {
+        while (!gops_.empty() && gops_.back().key > pts - kEpsilon) { // seek backward to a gop not cached, will be decoded again
+            drop(gops_.back());
+            gops_.pop_back();
+        }
+        gops_.push_back(Gop{pts});
+    }
+    void push(const VideoFrame& frame, size_t bytes) {
+        const auto t = frame.timestamp();
+        auto it = std::find_if(gops_.rbegin(), gops_.rend(), [t](const Gop& g) { return t >= g.key - kEpsilon; });
+        if (it == gops_.rend()) // leading frames of an open gop
+            return;
+        for (auto prev = it + 1; prev != gops_.rend() && !prev->complete; ++prev) // frame of a later gop is out
+            prev->complete = !prev->dropped;
+        if (it->dropped)
+            return;
+        it->frames.push_back({frame, bytes});
+        frames_++;
+        bytes_ += bytes;
+        trim(&*it);
+    }
+    // frames of a complete gop starting at key
+    const std::deque<std::pair<VideoFrame, size_t>>* find(double key) const {
+        for (const auto& g : gops_) {
+            if (g.complete && std::abs(g.key - key) < kEpsilon)
+                return &g.frames;
+        }
+        return nullptr;
+    }
+    int frames() const { return frames_; }
+    size_t bytes() const { return bytes_; }
+private:
+    static constexpr double kEpsilon = 0.0005; // pts is converted to/from mf time
+    struct Gop {
+        double key;
+        bool complete = false;
+        bool dropped = false; // exceeds limits, no longer cached
+        std::deque<std::pair<VideoFrame, size_t>> frames;
+    };
+
+    bool exceeds() const {
+        return (max_frames_ > 0 && frames_ > max_frames_) || (max_held_ > 0 && frames_ > max_held_) || (max_bytes_ > 0 && bytes_ > max_bytes_);
+    }
+    void drop(Gop& g) {
+        for (const auto& f : g.frames) {
+            frames_--;
+            bytes_ -= f.second;
+        }
+        g.frames.clear();
+        g.dropped = true;
+        g.complete = false;
+    }
+    void trim(Gop* current) {
+        if (max_frames_ < 0) { // only the last complete gop and the current gop
+            while (gops_.size() > 2 && &gops_.front() != current) {
+                drop(gops_.front());
+                gops_.pop_front();
+            }
+        }
+        while (exceeds() && &gops_.front() != current) { // a gop without head frames can not be replayed, drop the whole gop
+            drop(gops_.front());
+            gops_.pop_front();
+        }
+        if (exceeds())
+            drop(*current);
+    }
+
+    int max_frames_ = 0;
+    int max_held_ = 0;
+    size_t max_bytes_ = 0;
+    int frames_ = 0;
+    size_t bytes_ = 0;
+    std::deque<Gop> gops_;
+};
+
+// measures decode time against stream frame duration. level 0 is the user's fast/power properties, higher is faster with lower quality
+class SpeedGovernor
+{
+public:
+    struct Level {
+        UINT32 fast; // eAVFastDecodeMode
+        UINT32 power;
+    };
+    using clock = std::chrono::steady_clock;
+
+    // levels are never slower than the base level
+    void reset(UINT32 fast, int power) {
+        const Level base{fast, power < 0 ? 100 : (UINT32)power};
+        for (size_t i = 0; i < std::size(levels_); ++i)
+            levels_[i] = {std::max<UINT32>(kLevels[i].fast, base.fast), std::min<UINT32>(kLevels[i].power, base.power)};
+        level_ = 0;
+        over_ = under_ = 0;
+        resetWindow();
+    }
+    // decoding time of frames before a flush/seek is not comparable
+    void resetWindow() {
+        frames_ = 0;
+        busy_ = clock::duration::zero();
+    }
+    int level() const { return level_; }
+    int maxLevel() const { return (int)std::size(levels_) - 1; }
+    const Level& current() const { return levels_[level_]; }
+    void begin() { t0_ = clock::now(); }
+    void end() { busy_ += clock::now() - t0_; }
+    // returns true if level changed
+    bool onFrame(double pts) {
+        if (frames_++ == 0)
+            pts0_ = pts;
+        if (frames_ < kWindow)
+            return false;
+        const auto span = pts - pts0_; // stream time of frames_ - 1 intervals
+        const auto load = std::chrono::duration<double>(busy_).count() * (frames_ - 1) / frames_ / span;
+        resetWindow();
+        if (span <= 0) // bad pts
+            return false;
+        if (load > kHigh) {
+            under_ = 0;
+            if (++over_ < kUpCount || level_ >= maxLevel())
+                return false;
+            over_ = 0;
+            level_++;
+            return true;
+        }
+        over_ = 0;
+        if (load > kLow) {
+            under_ = 0;
+            return false;
+        }
+        if (++under_ < kDownCount || level_ <= 0)
+            return false;
+        under_ = 0;
+        level_--;
+        return true;
+    }
+private:
+    static constexpr int kWindow = 30;
+    static constexpr double kHigh = 0.9; // decode time / frame duration
+    static constexpr double kLow = 0.5;
+    static constexpr int kUpCount = 2; // windows in a row. react to slow decoding faster than to fast decoding
+    static constexpr int kDownCount = 4;
+    static constexpr Level kLevels[] = {
+        {0, 100},
+        {1, 50}, // eVideoDecodeOptimalLF
+        {2, 0}, // eVideoDecodeDisableLF
+        {32, 0}, // eVideoDecodeFastest
+    };
+
+    Level levels_[std::size(kLevels)] = {};
+    int level_ = 0;
+    int over_ = 0;
+    int under_ = 0;
+    int frames_ = 0;
+    double pts0_ = 0;
+    clock::time_point t0_;
+    clock::duration busy_ = clock::duration::zero();
+};
+
+// divides a core budget among live software decoders. shares are applied by each decoder in it's decoding thread
+class ThreadBudget
+{
+public:
+    static ThreadBudget& instance() {
+        static ThreadBudget tb;
+        return tb;
+    }
+    // cores: budget for all decoders, the last value wins. returns the share of the decoder
+    int add(const void* id, int64_t weight, int cores) {
+        lock_guard<mutex> lock(mtx_);
+        cores_ = cores;
+        entries_.push_back({id, std::max<int64_t>(weight, 1), 1});
+        rebalance();
+        return entries_.back().share;
+    }
+    void remove(const void* id) {
+        lock_guard<mutex> lock(mtx_);
+        entries_.erase(std::remove_if(entries_.begin(), entries_.end(), [id](const Entry& e) { return e.id == id; }), entries_.end());
+        rebalance();
+    }
+    int generation() const { return gen_.load(memory_order_acquire); }
+    int share(const void* id) {
+        lock_guard<mutex> lock(mtx_);
+        for (const auto& e : entries_) {
+            if (e.id == id)
+                return e.share;
+        }
+        return 0;
+    }
+private:
+    struct Entry {
+        const void* id;
+        int64_t weight;
+        int share;
+    };
+
+    void rebalance() {
+        int64_t total = 0;
+        for (const auto& e : entries_)
+            total += e.weight;
+        for (auto& e : entries_)
+            e.share = std::max<int>(1, int(cores_ * e.weight / std::max<int64_t>(total, 1))); // at least 1 thread even if over budget
+        gen_.fetch_add(1, memory_order_release);
+        clog << "thread budget " << cores_ << " is shared by " << entries_.size() << " decoders" << endl;
+    }
+
+    mutex mtx_;
+    atomic<int> gen_{0};
+    int cores_ = 0;
+    vector<Entry> entries_;
+};
+
+// software decoder options, can be changed on the fly
+static const struct CodecProperty {
+    const char* name;
+    const GUID& api;
+    int min;
+    int max;
+    const char* def;
+    bool apply_def; // apply default value when the transform is created
+} kCodecProperties[] = {
+    {"threads", CODECAPI_AVDecNumWorkerThreads, 0, 256, "0", true}, // 0: hardware_concurrency()
+    {"priority", CODECAPI_AVPriorityControl, -2, 2, "0", false}, // https://docs.microsoft.com/en-us/windows/win32/api/processthreadsapi/nf-processthreadsapi-setthreadpriority
+    {"fast", CODECAPI_AVDecVideoFastDecodeMode, 0, 32, "0", false}, // eAVFastDecodeMode. https://docs.microsoft.com/en-us/windows/win32/directshow/avdecvideofastdecodemode
+    {"power", CODECAPI_AVDecVideoSWPowerLevel, 0, 100, "-1", false}, // software power saving level in MPEG4 Part 2, VC1 and H264
+    {"deinterlace", CODECAPI_AVDecVideoSoftwareDeinterlaceMode, 0, 3, "0", false},
+};
+
+static bool toCodecValue(const CodecProperty& p, const std::string& value, UINT32* val)
+{
+    char* end = nullptr;
+    int v = (int)strtol(value.data(), &end, 10);
+    if (end == value.data() || *end || v < p.min || v > p.max) {
+        if (value != p.def)
+            clog << "invalid value for property " << p.name << ": " << value << ", range: [" << p.min << ", " << p.max << "]" << endl;
+        return false;
+    }
+    if (p.api == CODECAPI_AVDecNumWorkerThreads && v == 0)
+        v = thread::hardware_concurrency();
+    *val = (UINT32)v;
+    return true;
+}
+
 class MFTVideoDecoder final : public VideoDecoder, protected MFTCodec
 {
 public:
@@ -83,22 +379,41 @@ public:
     bool close() override;
     bool flush() override {
         bool ret =  flushCodec();
+        csd_sent_ = false; // parameter sets may be changed in band
+        seeking_ = ring_.enabled();
+        speed_.resetWindow();
         onFlush();
         return ret;
     }
-    int decode(const Packet& pkt) override { return decodePacket(pkt); }
+    int decode(const Packet& pkt) override;
 private:
     void onPropertyChanged(const std::string& key, const std::string& value) override {
         VideoDecoder::onPropertyChanged(key, value);
         if (key == "copy")
             copy_ = std::stoi(value);
+        else if (key == "copy_threads" || key == "copy_threads_min")
+            updateCopyThreads();
         else if (key == "pool")
             useSamplePool(std::stoi(value));
+        else if (key == "caps") // no need to open
+            publishCaps(value);
+        else if (std::any_of(std::cbegin(kCodecProperties), std::cend(kCodecProperties), [&](const CodecProperty& x) { return key == x.name; })) { // applied in decode thread
+            lock_guard<mutex> lock(codec_props_mutex_);
+            codec_props_.emplace_back(key, value);
+        }
+        else if (key == "lateness") { // applied in decode thread
+            lateness_ = std::stod(value);
+            lateness_changed_ = true;
+        }
     }
 
     bool onMFTCreated(ComPtr<IMFTransform> mft) override;
     bool testConstraints(ComPtr<IMFTransform> mft);
-    BufferRef filter(BufferRef in) override;
+    bool testStream(const SPSInfo& info) const;
+    void applyPlacement(IMFAttributes* a);
+    bool applyLowLatency();
+    int filter(const uint8_t* data, int size, uint8_t* out) override;
+    void onRecovered() override;
 
     bool setInputTypeAttributes(IMFAttributes* attr) override;
     bool setOutputTypeAttributes(IMFAttributes* attr) override;
@@ -106,9 +421,26 @@ private:
     int getOutputTypeScore(IMFAttributes* attr) override;
     bool onOutputTypeChanged(DWORD streamId, ComPtr<IMFMediaType> type) override; // width/height, pixel format, yuv mat, color primary/transfer func/chroma sitting/range, par
     bool onOutput(ComPtr<IMFSample> sample) override;
+    bool replay(const Packet& pkt);
+    void onThumbnail(const VideoFrame& frame);
+    void applySpeedLevel();
+    bool applyCodecProperty(const std::string& key, const std::string& value);
+    void applyCodecProperties();
+    bool skipPacket(const Packet& pkt);
+    void updateParameterSets(const Packet& pkt);
+    void setParameterSets(const uint8_t* data, size_t size, int nal_size, bool* sps_changed = nullptr);
+    int joinThreadBudget();
+    void leaveThreadBudget();
+    void updateThreadBudget();
+    void endThumbnails();
+    void updateCopyThreads();
+    void publishCounters();
+    void publishCaps(const std::string& codecs);
 
     // properties
     int copy_ = 0;
+    std::atomic<int> copy_threads_{1}; // set on the fly, read in decode thread
+    std::atomic<size_t> copy_threads_min_{0}; // frame size in bytes
     int use_d3d_ = 0;
     VideoFormat force_fmt_;
 
@@ -116,20 +448,84 @@ private:
     int nal_size_ = 0;
     int csd_size_ = 0;
     uint8_t* csd_ = nullptr;
+    SPSInfo sps_;
+    std::map<int, std::vector<uint8_t>> param_sets_; // (nal type << 8 | id) => nal, in vps, sps, pps order
+    int skip_nonref_ = 0;
+    int max_tid_ = -1;
+    bool late_ = false;
+    std::atomic<double> lateness_{0}; // set by renderer
+    std::atomic<bool> lateness_changed_{false};
+    uint64_t skipped_ = 0;
     bool csd_sent_ = false;
     VideoFrame frame_param_;
-    UINT32 stride_x_ = 0;
-    UINT32 stride_y_ = 0;
+    ColorSpace cs_;
+    HDRMetadata hdr_{};
+    bool has_hdr_ = false; // output type has hdr metadata
+    std::shared_ptr<NativeVideoBuffer> pool_buf_;
+    MF::PlaneLayout layout_;
+    bool convert_ = false; // copied frames are converted to force_fmt_ if output type is not
 #if (MS_API_DESKTOP+0)
     D3D9::Manager mgr9_;
 #endif
     D3D11::Manager mgr11_;
     NativeVideoBufferPoolRef pool_;
+    FrameRing ring_;
+    int ring_held_ = 0; // max frames held by ring
+    static constexpr int kPoolSpare = 16; // idle samples kept in pool besides ring frames, for frames in decoder and renderer
+    bool seeking_ = false; // replay ring frames iff after flush
+
+    std::atomic<bool> budgeted_{false};
+    int budget_gen_ = 0;
+    std::string codec_accepted_; // codec properties accepted by the transform on the fly
+    std::mutex codec_props_mutex_;
+    std::vector<std::pair<std::string, std::string>> codec_props_; // changed on the fly, applied in decode thread
+    bool governor_ = false;
+    SpeedGovernor speed_;
+
+    bool thumbnail_ = false;
+    std::string thumb_key_; // parameters of the transform kept for the next open
+    bool thumb_all_ = true;
+    std::deque<double> thumb_times_;
+    VideoFrame thumb_;
 };
 
 bool MFTVideoDecoder::open()
 {
     copy_ = std::stoi(property("copy", "0"));
+    updateCopyThreads();
+    const auto ring = std::stoi(property("ring", "0"));
+    const auto ring_mem = (size_t)std::stoi(property("ring_mem", "64")) << 20;
+    ring_held_ = ring;
+    if (ring < 0) { // output size is unknown yet
+        const auto& p = parameters();
+        const auto bytes = std::max<size_t>(1, (size_t)p.width * p.height * 3 / 2 * (VideoFormat(p.format).bitsPerChannel() > 8 ? 2 : 1));
+        ring_held_ = (int)std::min<size_t>(32, std::max<size_t>(1, ring_mem / bytes));
+    }
+    ring_.setLimits(ring, ring_mem, ring_held_);
+    setSamplePoolLimit(ring_held_ > 0 ? ring_held_ + kPoolSpare : 0);
+    seeking_ = false;
+    governor_ = std::stoi(property("governor", "0"));
+    speed_.reset(std::stoi(property("fast", "0")), std::stoi(property("power", "-1")));
+    thumbnail_ = std::stoi(property("thumbnail", "0"));
+    trackFrames();
+    recoverAtKeyFrame(std::stoi(property("recover", "0")));
+    codec_accepted_.clear();
+    skip_nonref_ = std::stoi(property("skip_nonref", "0"));
+    max_tid_ = std::stoi(property("max_temporal_id", "-1"));
+    late_ = false;
+    lateness_ = 0;
+    lateness_changed_ = false;
+    skipped_ = 0;
+    thumb_times_.clear();
+    thumb_ = VideoFrame();
+    if (thumbnail_) {
+        stringstream ss(property("thumbnail_times", ""));
+        string t;
+        while (getline(ss, t, ','))
+            thumb_times_.push_back(std::stod(t));
+        std::sort(thumb_times_.begin(), thumb_times_.end());
+    }
+    thumb_all_ = thumb_times_.empty();
     force_fmt_ = VideoFormat::fromName(property("format", "unknown").data());
 
     const auto blacklist = property("blacklist", "mpeg4");
@@ -169,15 +565,57 @@ bool MFTVideoDecoder::open()
         else if (strstr(par.codec.data(), "hevc") || strstr(par.codec.data(), "h265"))
             to_annexb_func = hvcc_to_annexb_extradata;
         if (to_annexb_func) {
-            if (!is_annexb(extra.data(), (int)extra.size())) {
+            if (!is_annexb_data(extra.data(), extra.size())) {
                 std::clog << "try to convert extra data to annexb" << std::endl;
                 csd_ = to_annexb_func(extra.data(), (int)extra.size(), &csd_size_, &nal_size_);
             }
         }
     }
-    if (!openCodec(MediaType::Video, *codec_id_, this))
+    sps_ = SPSInfo();
+    param_sets_.clear();
+    const bool hevc = *codec_id_ == MFVideoFormat_HEVC;
+    if (hevc || *codec_id_ == MFVideoFormat_H264) {
+        const auto ok = csd_ ? parse_sps_annexb(csd_, csd_size_, hevc, &sps_) : parse_sps_annexb(par.extra.data(), par.extra.size(), hevc, &sps_);
+        if (csd_)
+            setParameterSets(csd_, csd_size_, 0);
+        if (!ok && !csd_ && hevc)
+            parse_hvcc(par.extra.data(), par.extra.size(), &sps_);
+        if (ok)
+            clog << fmt::to_string("sps: profile %d, level %d, %dx%d, %d bit, max reorder: %d, max dec buffering: %d", sps_.profile, sps_.level, sps_.width, sps_.height, sps_.bit_depth, sps_.max_reorder, sps_.max_dec_buffering) << endl;
+    }
+    if (*codec_id_ == MFVideoFormat_VP90)
+        parse_vpcc(par.extra.data(), par.extra.size(), &sps_);
+    else if (*codec_id_ == MFVideoFormat_AV1)
+        parse_av1c(par.extra.data(), par.extra.size(), &sps_);
+    if (!testStream(sps_))
+        return false;
+    // output type and surfaces depend on d3d, copy and format
+    const auto key = par.codec + "/" + std::to_string(par.width) + "x" + std::to_string(par.height) + "/" + std::to_string(VideoFormat(par.format).bitsPerChannel())
+        + "/d3d" + property("d3d", "0") + "/copy" + std::to_string(copy_) + "/" + property("format", "unknown");
+    if (mft_ && (!thumbnail_ || key != thumb_key_))
+        closeCodec();
+    thumb_key_.clear();
+    if (mft_) {
+        std::clog << "reuse MFT for thumbnails: " << key << std::endl;
+        if (!flushCodec())
+            return false;
+        // per stream setup done by onMFTCreated() and openCodec() for a new transform
+        resetCounters();
+        setCodecValue(CODECAPI_AVLowLatencyMode, applyLowLatency());
+        const auto share = joinThreadBudget();
+        if (share > 0)
+            setCodecValue(CODECAPI_AVDecNumWorkerThreads, share);
+    } else if (!openCodec(MediaType::Video, *codec_id_, this)) {
+        leaveThreadBudget();
         return false;
+    }
+    if (thumbnail_)
+        thumb_key_ = key;
+    if (pool_) // hw decoder
+        governor_ = false;
     std::clog << "MFT decoder is ready" << std::endl;
+    setProperty("input.alignment", std::to_string(inputAlignment()));
+    setProperty("input.padding", std::to_string(inputPadding()));
     onOpen();
     return true;
 }
@@ -189,15 +627,301 @@ bool MFTVideoDecoder::close()
     csd_ = nullptr;
     csd_size_ = 0;
     csd_sent_ = false;
-    bool ret = closeCodec();
+    ring_.clear();
+    thumb_ = VideoFrame();
+    leaveThreadBudget();
+    if (skipped_ > 0)
+        clog << "frames dropped before decoding: " << skipped_ << endl;
+    bool ret = true;
+    if (thumb_key_.empty() || !mft_) // keep the transform for the next file
+        ret = closeCodec();
     onClose();
     return ret;
 }
 
+int MFTVideoDecoder::decode(const Packet& pkt)
+{
+    applyCodecProperties();
+    if (budgeted_)
+        updateThreadBudget();
+    if (lateness_changed_.exchange(false)) {
+        const double lateness = lateness_;
+        late_ = lateness > 0;
+        setLateness(lateness);
+    }
+    if (pkt.hasKeyFrame)
+        publishCounters();
+    if (governor_)
+        speed_.begin();
+    auto measure = scope_atexit([this]{
+        if (governor_)
+            speed_.end();
+    });
+    if (thumbnail_) {
+        if (pkt.isEnd()) {
+            const auto ret = decodePacket(pkt);
+            endThumbnails();
+            return ret;
+        }
+        if (!pkt.hasKeyFrame) // never reaches ProcessInput
+            return true;
+        if (thumb_times_.empty() && !thumb_all_) // all requested frames are out
+            return true;
+    }
+    if (pkt.isEnd())
+        return decodePacket(pkt);
+    if (seeking_) {
+        if (replay(pkt))
+            return true;
+        if (!pkt.hasKeyFrame) // replayed gop, or seek target is not a key frame
+            return true;
+        seeking_ = false;
+    }
+    if (ring_.enabled() && pkt.hasKeyFrame)
+        ring_.addKey(pkt.pts);
+    if (skipPacket(pkt)) {
+        onPacketSkipped(pkt);
+        return true;
+    }
+    updateParameterSets(pkt);
+    return decodePacket(pkt);
+}
+
+void MFTVideoDecoder::publishCounters()
+{
+    setProperty("input.zero_copy", std::to_string(zeroCopyInputs()));
+    setProperty("input.copied", std::to_string(copiedInputs()));
+    setProperty("frames.skipped", std::to_string(skipped_));
+    setProperty("frames.decoded", std::to_string(decodedFrames()));
+    setProperty("frames.dropped", std::to_string(droppedFrames()));
+    setProperty("buffers.locked", std::to_string(MF::buffer_locks()));
+}
+
+void MFTVideoDecoder::publishCaps(const std::string& codecs)
+{
+    if (codecs == "probe") {
+        MF::probe_decoder_caps_async();
+        return;
+    }
+    const auto d3d = std::stoi(property("d3d", "0"));
+    stringstream ss(codecs);
+    string codec;
+    while (getline(ss, codec, ',')) {
+        const auto caps = MF::decoder_caps(codec, d3d);
+        if (!caps.probed) // not a supported codec
+            continue;
+        setProperty("caps." + codec, fmt::to_string("software=%d,hardware=%d,d3d9=%d,d3d11=%d,max_width=%d,max_height=%d,max_bit_depth=%d"
+            , caps.software, caps.hardware, caps.d3d9, caps.d3d11, caps.max_width, caps.max_height, caps.max_bit_depth));
+    }
+}
+
+static const uint8_t kStartCode[] = {0, 0, 0, 1};
+
+// abr rendition switch, concatenated files etc. parameter sets are in key frame packets
+void MFTVideoDecoder::updateParameterSets(const Packet& pkt)
+{
+    if (!pkt.hasKeyFrame || !pkt.buffer || !pkt.buffer->constData() || (*codec_id_ != MFVideoFormat_H264 && *codec_id_ != MFVideoFormat_HEVC))
+        return;
+    const auto old = sps_;
+    bool sps_changed = false;
+    setParameterSets(pkt.buffer->constData(), pkt.buffer->size(), nal_size_, &sps_changed);
+    if (!sps_changed || old.width <= 0)
+        return;
+    clog << fmt::to_string("in band sps change: %dx%d => %dx%d, profile %d => %d, %d bit => %d bit", old.width, old.height, sps_.width, sps_.height, old.profile, sps_.profile, old.bit_depth, sps_.bit_depth) << endl;
+    drainCodec(); // output frames of old parameters. new parameters are in this packet, and the transform will change output type
+}
+
+// store parameter sets by id, and rebuild annexb csd to be sent after flush
+void MFTVideoDecoder::setParameterSets(const uint8_t* data, size_t size, int nal_size, bool* sps_changed)
+{
+    const bool hevc = *codec_id_ == MFVideoFormat_HEVC;
+    bool changed = false;
+    for_each_nal(data, size, nal_size, [&](const uint8_t* nal, size_t len) {
+        int type = 0, id = 0;
+        if (!parameter_set_id(nal, len, hevc, &type, &id))
+            return true;
+        auto& ps = param_sets_[(type << 8) | id];
+        if (ps.size() == len && memcmp(ps.data(), nal, len) == 0)
+            return true;
+        ps.assign(nal, nal + len);
+        changed = true;
+        SPSInfo s;
+        if (!(hevc ? parse_hevc_sps(nal, len, &s) : parse_h264_sps(nal, len, &s)))
+            return true;
+        if (sps_changed && (s.width != sps_.width || s.height != sps_.height || s.profile != sps_.profile || s.bit_depth != sps_.bit_depth || s.chroma_format != sps_.chroma_format))
+            *sps_changed = true;
+        sps_ = s;
+        return true;
+    });
+    if (!changed || !sps_changed) // from csd
+        return;
+    size_t csd_size = 0;
+    for (const auto& i : param_sets_)
+        csd_size += 4 + i.second.size();
+    auto csd = (uint8_t*)malloc(csd_size);
+    auto p = csd;
+    for (const auto& i : param_sets_) {
+        memcpy(p, kStartCode, sizeof(kStartCode));
+        memcpy(p + 4, i.second.data(), i.second.size());
+        p += 4 + i.second.size();
+    }
+    if (csd_)
+        free(csd_);
+    csd_ = csd;
+    csd_size_ = (int)csd_size;
+    csd_sent_ = true; // parameter sets are in current packet
+}
+
+bool MFTVideoDecoder::skipPacket(const Packet& pkt)
+{
+    if (pkt.hasKeyFrame || !pkt.buffer || (!skip_nonref_ && max_tid_ < 0))
+        return false;
+    const bool hevc = *codec_id_ == MFVideoFormat_HEVC;
+    if (!hevc && *codec_id_ != MFVideoFormat_H264)
+        return false;
+    const auto max_tid = hevc ? max_tid_ : -1;
+    const bool nonref = skip_nonref_ == 1 || (skip_nonref_ == 2 && late_);
+    if (!nonref && max_tid < 0)
+        return false;
+    if (!is_disposable(pkt.buffer->constData(), pkt.buffer->size(), nal_size_, hevc, nonref, max_tid, sps_.max_sub_layers))
+        return false;
+    skipped_++;
+    return true;
+}
+
+void MFTVideoDecoder::applyCodecProperties()
+{
+    std::vector<std::pair<std::string, std::string>> props;
+    {
+        lock_guard<mutex> lock(codec_props_mutex_);
+        if (codec_props_.empty())
+            return;
+        props.swap(codec_props_);
+    }
+    for (const auto& kv : props)
+        applyCodecProperty(kv.first, kv.second);
+}
+
+// returns true if key is a codec property
+bool MFTVideoDecoder::applyCodecProperty(const std::string& key, const std::string& value)
+{
+    const auto p = std::find_if(std::cbegin(kCodecProperties), std::cend(kCodecProperties), [&](const CodecProperty& x) { return key == x.name; });
+    if (p == std::cend(kCodecProperties))
+        return false;
+    UINT32 val = 0;
+    if (!toCodecValue(*p, value.empty() ? p->def : value, &val)) // power=-1: not applicable on the fly
+        return true;
+    if (key == "threads") // fixed by user
+        leaveThreadBudget();
+    const bool accepted = setCodecValue(p->api, val);
+    clog << "codec property " << key << "=" << value << (accepted ? " is" : " is not") << " accepted by MFT" << endl;
+    if (governor_ && (key == "fast" || key == "power"))
+        speed_.reset(std::stoi(property("fast", "0")), std::stoi(property("power", "-1")));
+    if (accepted && (","+ codec_accepted_ + ",").find("," + key + ",") == string::npos) {
+        codec_accepted_ += (codec_accepted_.empty() ? "" : ",") + key;
+        setProperty("codec.accepted", codec_accepted_);
+    }
+    return true;
+}
+
+// software decoders with default threads only
+int MFTVideoDecoder::joinThreadBudget()
+{
+    leaveThreadBudget();
+    auto cores = std::stoi(property("thread_budget", "0"));
+    if (cores == 0 || use_d3d_ != 0 || std::stoi(property("threads", "0")) != 0) // hw decoder requested
+        return 0;
+    if (cores < 0)
+        cores = thread::hardware_concurrency();
+    const auto& par = parameters();
+    const auto priority = std::clamp(std::stoi(property("priority", "0")), -2, 2);
+    const auto weight = (int64_t)par.width * par.height * (1 << (priority + 2)) / 4; // below normal: half weight
+    auto& tb = ThreadBudget::instance();
+    const auto share = tb.add(this, weight, cores);
+    budgeted_ = true;
+    budget_gen_ = tb.generation();
+    clog << "worker threads from budget: " << share << "/" << cores << endl;
+    return share;
+}
+
+void MFTVideoDecoder::leaveThreadBudget()
+{
+    if (!budgeted_.exchange(false))
+        return;
+    ThreadBudget::instance().remove(this);
+}
+
+// other decoders opened or closed
+void MFTVideoDecoder::updateThreadBudget()
+{
+    auto& tb = ThreadBudget::instance();
+    const auto gen = tb.generation();
+    if (gen == budget_gen_)
+        return;
+    budget_gen_ = gen;
+    const auto share = tb.share(this);
+    if (share > 0 && setCodecValue(CODECAPI_AVDecNumWorkerThreads, share))
+        clog << "worker threads are updated from budget: " << share << endl;
+}
+
+void MFTVideoDecoder::applySpeedLevel()
+{
+    const auto& l = speed_.current();
+    const bool fast = setCodecValue(CODECAPI_AVDecVideoFastDecodeMode, l.fast);
+    const bool power = setCodecValue(CODECAPI_AVDecVideoSWPowerLevel, l.power);
+    clog << fmt::to_string("decode speed level %d/%d: fast=%u(%d), power=%u(%d)", speed_.level(), speed_.maxLevel(), l.fast, fast, l.power, power) << endl;
+    setProperty("governor.level", std::to_string(speed_.level()));
+}
+
+// packets of a cached gop are skipped, and a replayed gop is followed by another key frame packet, so the mft is always fed from a key frame
+bool MFTVideoDecoder::replay(const Packet& pkt)
+{
+    if (!pkt.hasKeyFrame)
+        return false;
+    const auto frames = ring_.find(pkt.pts);
+    if (!frames)
+        return false;
+    clog << fmt::to_string("replay %d frames from ring for key frame @%.3f", (int)frames->size(), pkt.pts) << endl;
+    for (const auto& f : *frames)
+        frameDecoded(f.first);
+    return true;
+}
+
+// frame for time t is the last key frame <= t, known when a later frame is out. use the 1st frame if no frame <= t
+void MFTVideoDecoder::onThumbnail(const VideoFrame& frame)
+{
+    if (thumb_times_.empty()) {
+        frameDecoded(frame);
+        return;
+    }
+    while (!thumb_times_.empty() && frame.timestamp() > thumb_times_.front()) {
+        frameDecoded(thumb_ ? thumb_ : frame);
+        thumb_times_.pop_front();
+    }
+    thumb_ = frame;
+}
+
+void MFTVideoDecoder::endThumbnails()
+{
+    for (; !thumb_times_.empty() && thumb_; thumb_times_.pop_front())
+        frameDecoded(thumb_);
+    thumb_ = VideoFrame();
+}
+
+void MFTVideoDecoder::updateCopyThreads()
+{
+    auto threads = std::stoi(property("copy_threads", "0"));
+    if (threads < 0)
+        threads = std::min<int>(thread::hardware_concurrency() / 2, 4);
+    copy_threads_ = std::max<int>(threads, 1);
+    copy_threads_min_ = size_t(std::stoi(property("copy_threads_min", "16"))) << 20;
+}
+
 bool MFTVideoDecoder::onMFTCreated(ComPtr<IMFTransform> mft)
 {
     if (!testConstraints(mft))
         return false;
+    pool_.reset(); // set iff d3d manager is accepted by this transform
     use_d3d_ = std::stoi(property("d3d", "0"));
     int adapter = std::stoi(property("adapter", "0"));
     auto vendor_s = property("vendor");
@@ -249,35 +973,104 @@ bool MFTVideoDecoder::onMFTCreated(ComPtr<IMFTransform> mft)
         - too large latency on some devices, so video becomes stutter
        seems disabling low latency is required iff codec is hevc(depending on mft plugin?)
     */
-    const auto& par = parameters();
-    bool low_latency = true;
-    if (strstr(par.codec.data(), "hevc") || strstr(par.codec.data(), "h265"))
-        low_latency = false;
-    if (std::stoi(property("low_latency", std::to_string(low_latency)))) // or MF_LOW_LATENCY for win8+
+    if (applyLowLatency()) // or MF_LOW_LATENCY for win8+
         MS_WARN(a->SetUINT32(CODECAPI_AVLowLatencyMode, 1)); // .vt = VT_BOOL, .boolVal = VARIANT_TRUE fails
     // https://docs.microsoft.com/en-us/gaming/gdk/_content/gc/system/overviews/mediafoundation-decode#software-decode-1
     // options for sw decoder. defined in um/codecapi.h
-    auto val = std::stoi(property("threads", "0"));
-    if (val == 0)
-        val = thread::hardware_concurrency();
-    MS_WARN(a->SetUINT32(CODECAPI_AVDecNumWorkerThreads, val));
-    // TODO: apply on the fly?
-    val = std::stoi(property("priority", "0")); // -2(lowest), -1(below normal), 0(normal), 1(above normal), 2(highest)
-    if (val != 0) // https://docs.microsoft.com/en-us/windows/win32/api/processthreadsapi/nf-processthreadsapi-setthreadpriority
-        MS_WARN(a->SetUINT32(CODECAPI_AVPriorityControl, val));
-    val = std::stoi(property("fast", "0")); // 0: normal, 1: Optimal Loop Filter, 2: Disable Loop Filter, ..., 32: fastest
-    if (val != 0) // https://docs.microsoft.com/en-us/windows/win32/directshow/avdecvideofastdecodemode
-        MS_WARN(a->SetUINT32(CODECAPI_AVDecVideoFastDecodeMode, val)); // eAVFastDecodeMode
-    // software power saving level in MPEG4 Part 2, VC1 and H264, 0~100
-    val = std::stoi(property("power", "-1")); // 0 - Optimize for battery life, 50 - balanced, 100 - Optimize for video quality
-    if (val >= 0)
-        MS_WARN(a->SetUINT32(CODECAPI_AVDecVideoSWPowerLevel, val));
-    val = std::stoi(property("deinterlace", "0")); // 0: no, 1: progressive, 2: bob, 3: smart bob
-    if (val != 0)
-        MS_WARN(a->SetUINT32(CODECAPI_AVDecVideoSoftwareDeinterlaceMode, val));
-    // CODECAPI_AVDecVideoThreadAffinityMask, same as Win32 SetThreadAffinityMask
+    for (const auto& p : kCodecProperties) {
+        const auto value = property(p.name, p.def);
+        UINT32 val = 0;
+        if ((p.apply_def || value != p.def) && toCodecValue(p, value, &val))
+            MS_WARN(a->SetUINT32(p.api, val));
+    }
+    const auto share = joinThreadBudget();
+    if (share > 0)
+        MS_WARN(a->SetUINT32(CODECAPI_AVDecNumWorkerThreads, share));
+    applyPlacement(a.Get());
     // CODECAPI_AVDecDisableVideoPostProcessing (0,1): deblocking/deringing
-    // CODECAPI_AVDecVideoThumbnailGenerationMode: can decode I frame onlyx
+    if (std::stoi(property("thumbnail", "0"))) // decode I frames only
+        MS_WARN(a->SetUINT32(CODECAPI_AVDecVideoThumbnailGenerationMode, 1));
+    return true;
+}
+
+// low latency mode for current stream(sps), and timestamp reordering depending on it
+bool MFTVideoDecoder::applyLowLatency()
+{
+    const auto& par = parameters();
+    bool low_latency = true;
+    if (sps_.max_reorder == 0) // no b-frame, nothing to reorder
+        low_latency = true;
+    else if (strstr(par.codec.data(), "hevc") || strstr(par.codec.data(), "h265"))
+        low_latency = false;
+    low_latency = std::stoi(property("low_latency", std::to_string(low_latency)));
+    // output queue depth: dpb from sps, but frame threaded software transforms hold more inputs, one per worker, so keep large enough for them
+    const auto depth = std::max<int>(32, std::max<int>(sps_.max_dec_buffering, sps_.max_reorder) + 1);
+    reorderTimestamps(low_latency && sps_.max_reorder != 0 && !std::stoi(property("trust_pts", "0")), depth); // fix bad pts
+    return low_latency;
+}
+
+// CODECAPI_AVDecVideoThreadAffinityMask, same as Win32 SetThreadAffinityMask, but VT_UI4
+void MFTVideoDecoder::applyPlacement(IMFAttributes* a)
+{
+    auto mask = std::stoull(property("affinity", "0"), nullptr, 0);
+    const auto node = std::stoi(property("numa_node", "-1"));
+    setNumaNode(-1);
+#if (MS_API_DESKTOP+0)
+    if (node >= 0) {
+        GROUP_AFFINITY ga{};
+        ULONGLONG node_mask = 0;
+        if (GetNumaNodeProcessorMaskEx((USHORT)node, &ga)) { // win7+
+            if (ga.Group != 0)
+                clog << "numa node " << node << " is in processor group " << ga.Group << ", affinity mask can not be applied" << endl;
+            else
+                node_mask = ga.Mask;
+        } else if (!GetNumaNodeProcessorMask((UCHAR)node, &node_mask)) {
+            clog << "invalid numa node: " << node << endl;
+        }
+        if (node_mask)
+            mask = mask ? (mask & node_mask) : node_mask;
+        setNumaNode(node);
+    }
+#endif
+    if (!mask) {
+        if (node >= 0)
+            clog << "placement: numa node " << node << " for output samples only" << endl;
+        return;
+    }
+    if (mask >> 32)
+        clog << "affinity mask is 32bit, processors above 31 are ignored" << endl;
+    HRESULT hr = S_OK;
+    MS_WARN((hr = a->SetUINT32(CODECAPI_AVDecVideoThreadAffinityMask, (UINT32)mask)));
+    clog << fmt::to_string("placement: numa node %d, worker thread affinity mask 0x%x%s", node, (UINT32)mask, SUCCEEDED(hr) ? "" : " failed") << endl;
+}
+
+// reject unsupported streams before creating a transform
+bool MFTVideoDecoder::testStream(const SPSInfo& info) const
+{
+    const bool ignore_profile = std::stoi(property("ignore_profile", "0"));
+    if (!ignore_profile) {
+        const auto& c = *codec_id_;
+        // microsoft hevc, vp9 and av1 decoders support 8/10bit 4:2:0(and 4:0:0) only
+        if ((c == MFVideoFormat_HEVC || c == MFVideoFormat_VP90 || c == MFVideoFormat_AV1 || c == MFVideoFormat_H264)
+            && (info.chroma_format > 1 || info.bit_depth > (c == MFVideoFormat_H264 ? 8 : 10))) {
+            clog << fmt::to_string("unsupported chroma format %d or bit depth %d. set property 'ignore_profile=1' to ignore profile restriction.", info.chroma_format, info.bit_depth) << endl;
+            return false;
+        }
+        if ((c == MFVideoFormat_VP90 && (info.profile == 1 || info.profile == 3)) // 4:2:2, 4:4:0, 4:4:4
+            || (c == MFVideoFormat_AV1 && info.profile > 0)) { // high, professional
+            clog << fmt::to_string("unsupported profile %d. set property 'ignore_profile=1' to ignore profile restriction.", info.profile) << endl;
+            return false;
+        }
+    }
+    MF::DecoderCaps caps;
+    if (!MF::cached_decoder_caps(parameters().codec, &caps, std::stoi(property("d3d", "0")))) // probed, or an opened transform
+        return true;
+    const int w = info.width > 0 ? info.width : parameters().width;
+    const int h = info.height > 0 ? info.height : parameters().height;
+    if (!caps.accepts(w, h, ignore_profile ? 0 : info.bit_depth)) {
+        clog << fmt::to_string("unsupported stream %dx%d %d bit. transforms: %d, max supported: %dx%d %d bit", w, h, info.bit_depth, caps.software, caps.max_width, caps.max_height, caps.max_bit_depth) << endl;
+        return false;
+    }
     return true;
 }
 
@@ -290,6 +1083,7 @@ bool MFTVideoDecoder::testConstraints(ComPtr<IMFTransform> mft)
     if (SUCCEEDED(a->GetUINT32(CODECAPI_AVDecVideoMaxCodedWidth, &max_w)) // TODO: we can set max value?
         && SUCCEEDED(a->GetUINT32(CODECAPI_AVDecVideoMaxCodedHeight, &max_h))) {
         std::clog << "max supported size: " << max_w << "x" << max_h << std::endl;
+        MF::update_decoder_caps(parameters().codec, std::stoi(property("d3d", "0")), (int)max_w, (int)max_h);
         // FIXME: par.width/height is not coded value
         if ((max_w > 0 && (int)max_w < parameters().width) || (max_h > 0 && (int)max_h <= parameters().height)) {
             std::clog << "unsupported frame size" << std::endl;
@@ -299,22 +1093,41 @@ bool MFTVideoDecoder::testConstraints(ComPtr<IMFTransform> mft)
     return true;
 }
 
-BufferRef MFTVideoDecoder::filter(BufferRef in)
+// prepend csd and convert length prefixed nals to annexb in 1 pass. input packet is untouched, so cached packets can be decoded again by a new decoder
+int MFTVideoDecoder::filter(const uint8_t* data, int size, uint8_t* out)
 {
-    if (nal_size_ <= 0 || !in)
-        return in;
-    // TODO: PacketFilter. convert in a new buffer and keep input packet untouched, so switching to a new decoder can decode previously cached packets(from the last key frame packet) correctly
-    const int size = in->size();
-    ByteArray out(in->constData(), size);
-    to_annexb_packet(out.data(), size, nal_size_);
-    if (csd_sent_)
-        return make_shared<ByteArrayBuffer>(out);
-    csd_sent_ = true;
-    ByteArray csd_pkt(csd_size_ + size);
-    memcpy(csd_pkt.data(), csd_, csd_size_);
-    memcpy(csd_pkt.data() + csd_size_, out.constData(), size);
-    out = csd_pkt;
-    return make_shared<ByteArrayBuffer>(out);
+    const bool prepend = csd_ && !csd_sent_;
+    if (nal_size_ <= 0 && !prepend)
+        return -1;
+    int bytes = 0;
+    if (prepend) {
+        if (out) {
+            memcpy(out, csd_, csd_size_);
+            csd_sent_ = true;
+        }
+        bytes += csd_size_;
+    }
+    if (nal_size_ <= 0) { // annexb
+        if (out)
+            memcpy(out + bytes, data, size);
+        return bytes + size;
+    }
+    for_each_nal(data, size, nal_size_, [&](const uint8_t* nal, size_t len) {
+        if (out) {
+            memcpy(out + bytes, kStartCode, sizeof(kStartCode));
+            memcpy(out + bytes + sizeof(kStartCode), nal, len);
+        }
+        bytes += int(sizeof(kStartCode) + len);
+        return true;
+    });
+    return bytes;
+}
+
+void MFTVideoDecoder::onRecovered()
+{
+    csd_sent_ = false;
+    setProperty("recovery.count", std::to_string(recoveries()));
+    setProperty("recovery.discarded", std::to_string(discardedPackets()));
 }
 
 bool MFTVideoDecoder::setInputTypeAttributes(IMFAttributes* a)
@@ -359,9 +1172,19 @@ int MFTVideoDecoder::getOutputTypeScore(IMFAttributes* attr)
     if (force_fmt_ && force_fmt_ == vf)
         return 2;
     // if not the same as input format(depth), MF_E_TRANSFORM_STREAM_CHANGE will occur and have to select again(in a dead loop). e.g. input vp9 is 8bit, but p010 is selected, mft can refuse to use it.
-    return vf.bitsPerChannel() == VideoFormat(parameters().format).bitsPerChannel();
+    const auto depth = sps_.bit_depth > 0 ? sps_.bit_depth : VideoFormat(parameters().format).bitsPerChannel(); // sps can be changed in band
+    return vf.bitsPerChannel() == depth;
 }
 
+// stateless, shared by all frames of an output type. replaced by a pool buffer in MF::to()
+class PoolBuffer final : public NativeVideoBuffer
+{
+    NativeVideoBufferPoolRef pool_;
+public:
+    PoolBuffer(NativeVideoBufferPoolRef pool) : pool_(pool) {}
+    void* map(Type type, MapParameter*) override { return pool_.get();}
+};
+
 bool MFTVideoDecoder::onOutputTypeChanged(DWORD streamId, ComPtr<IMFMediaType> type)
 {
     ComPtr<IMFAttributes> a;
@@ -377,23 +1200,33 @@ bool MFTVideoDecoder::onOutputTypeChanged(DWORD streamId, ComPtr<IMFMediaType> t
     MS_ENSURE(a->GetUINT64(MF_MT_FRAME_SIZE, &dim), false);
     UINT32 w = 0, h = 0;
     Unpack2UINT32AsUINT64(dim, &w, &h);
-    stride_x_ = outfmt.bytesPerLine(w, 0);
-    stride_y_ = h;
-    std::clog << "output size: " << w << "x" << h << ", stride: " << stride_x_ << "x" << stride_y_ << std::endl;
+    if (!MF::to(layout_, a.Get()))
+        return false;
+    setOutputLayout(layout_);
+    std::clog << "output size: " << w << "x" << h << ", pitch: " << layout_.pitch[0] << ", buffer size: " << layout_.total << std::endl;
     MFVideoArea area{}; // desktop only?
     if (SUCCEEDED(a->GetBlob(MF_MT_MINIMUM_DISPLAY_APERTURE, (UINT8*)&area, sizeof(area), nullptr))) {
         std::clog << "video area: (" << area.OffsetX.value << ", " << area.OffsetY.value << "), " << area.Area.cx << "x" << area.Area.cy << std::endl;
         w = area.Area.cx;
         h = area.Area.cy;
     }
-    ColorSpace cs;
-    MF::to(cs, a.Get());
-    HDRMetadata hdr{};
-    MF::to(hdr, a.Get()); // frame level(hevc ts, mkv)?
+    cs_ = ColorSpace();
+    MF::to(cs_, a.Get());
+    hdr_ = HDRMetadata{};
+    MF::to(hdr_, a.Get()); // frame level(hevc ts, mkv)?
+    has_hdr_ = hdr_.mastering.luminance_max > 0 || hdr_.mastering.W[0] > 0 || hdr_.content_light.MaxCLL > 0 || hdr_.content_light.MaxFALL > 0;
+    convert_ = force_fmt_ && !(force_fmt_ == outfmt) && MF::can_convert(outfmt, force_fmt_);
+    if (convert_)
+        std::clog << "copied frames are converted to " << force_fmt_ << " (" << pixel_convert_impl() << ")" << std::endl;
     frame_param_ = VideoFrame(w, h, outfmt);
-    frame_param_.setColorSpace(cs, true);
-    frame_param_.setMasteringMetadata(hdr.mastering, false);
-    frame_param_.setContentLightMetadata(hdr.content_light, false);
+    frame_param_.setColorSpace(cs_, true);
+    if (has_hdr_) {
+        frame_param_.setMasteringMetadata(hdr_.mastering, false);
+        frame_param_.setContentLightMetadata(hdr_.content_light, false);
+    }
+    pool_buf_.reset();
+    if (pool_)
+        pool_buf_ = std::make_shared<PoolBuffer>(pool_);
     // TODO: interlace MF_MT_INTERLACE_MODE=>MFVideoInterlaceMode
     // TODO: MF_MT_PIXEL_ASPECT_RATIO, MF_MT_YUV_MATRIX, MF_MT_VIDEO_PRIMARIES, MF_MT_TRANSFER_FUNCTION, MF_MT_VIDEO_CHROMA_SITING, MF_MT_VIDEO_NOMINAL_RANGE
     // MFVideoPrimaries_BT709, MFVideoPrimaries_BT2020
@@ -423,33 +1256,41 @@ bool MFTVideoDecoder::onOutputTypeChanged(DWORD streamId, ComPtr<IMFMediaType> t
             MS_ENSURE(a->SetUINT32(MF_SA_D3D11_BINDFLAGS, D3D11_BIND_SHADER_RESOURCE/*|D3D11_BIND_DECODER*/), false); // optional?
         // MF_SA_D3D11_USAGE
         //MS_ENSURE(a->SetUINT32(MF_SA_BUFFERS_PER_SAMPLE , 1), false); // 3d video
+        // frames in ring hold mft surfaces, request more surfaces to avoid output stall. spare surfaces are for dpb and renderer, like sample pool
+        if (ring_held_ > 0 && copy_ == 0)
+            MS_WARN(a->SetUINT32(MF_SA_MINIMUM_OUTPUT_SAMPLE_COUNT, ring_held_ + kPoolSpare));
     }
     return true;
 }
 
 bool MFTVideoDecoder::onOutput(ComPtr<IMFSample> sample)
 {
-    class PoolBuffer : public NativeVideoBuffer
-    {
-        NativeVideoBufferPoolRef pool_;
-    public:
-        PoolBuffer(NativeVideoBufferPoolRef pool) : pool_(pool) {}
-        void* map(Type type, MapParameter*) override { return pool_.get();}
-    };
-    VideoFrame frame(frame_param_.width(), frame_param_.height(), frame_param_.format());
-    if (pool_)
-        frame.setNativeBuffer(std::make_shared<PoolBuffer>(pool_));
-    if (!MF::to(frame, sample, (int)stride_x_, (int)stride_y_, copy_))
+    // no heap allocation here except VideoFrame's own storage(see test/video_buffer_test.cpp). per output type data is prepared in onOutputTypeChanged()
+    // a frame gets its own planes, so only the template's parameters are copied. hdr metadata is copied only if the output type has it
+    VideoFrame frame(frame_param_.width(), frame_param_.height(), convert_ && copy_ > 0 ? force_fmt_ : frame_param_.format());
+    if (pool_buf_)
+        frame.setNativeBuffer(pool_buf_);
+    if (!MF::to(frame, sample, layout_, copy_, layout_.total >= copy_threads_min_ ? copy_threads_ : 1)) // copy is done here, before frameDecoded
         return false;
-    ColorSpace cs;
-    frame_param_.colorSpace(&cs, false);
-    frame.setColorSpace(cs, true);
-    HDRMetadata hdr{};
-    frame_param_.masteringMetadata(&hdr.mastering);
-    frame_param_.contentLightMetadata(&hdr.content_light);
-    frame.setMasteringMetadata(hdr.mastering, false);
-    frame.setContentLightMetadata(hdr.content_light, false);
-    frameDecoded(frame);
+    frame.setColorSpace(cs_, true);
+    if (has_hdr_) {
+        frame.setMasteringMetadata(hdr_.mastering, false);
+        frame.setContentLightMetadata(hdr_.content_light, false);
+    }
+    if (ring_.enabled()) {
+        ring_.push(frame, layout_.total); // held sample buffer, or copied planes
+    }
+    if (governor_) {
+        speed_.end(); // exclude time blocked in frameDecoded()
+        if (speed_.onFrame(frame.timestamp()))
+            applySpeedLevel();
+    }
+    if (thumbnail_)
+        onThumbnail(frame);
+    else
+        frameDecoded(frame);
+    if (governor_)
+        speed_.begin();
     return true;
 }
 
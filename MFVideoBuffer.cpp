@@ -0,0 +1,422 @@
+/*
+ * Copyright (c) 2018-2022 WangBin <wbsecg1 at gmail.com>
+ * This file is part of MDK MFT plugin
+ * Source code: https://github.com/wang-bin/mdk-mft
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+// decoded sample buffers => VideoFrame planes, called for every output frame of video decoders
+# pragma push_macro("_WIN32_WINNT")
+# if _WIN32_WINNT < 0x0602 // 0602: IMF2DBuffer2
+#   undef _WIN32_WINNT
+#   define _WIN32_WINNT 0x0602
+# endif
+#include "base/ms/MFGlue.h"
+#include "base/ms/PixelConvert.h"
+#include "base/ByteArrayBuffer.h"
+#include "mdk/VideoFrame.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <mutex>
+#if (MS_API_DESKTOP+0)
+#include <d3d9.h>
+#endif
+#include <d3d11.h>
+# pragma pop_macro("_WIN32_WINNT")
+
+MDK_NS_BEGIN
+namespace MF {
+
+#if (MS_API_DESKTOP+0)
+#undef DEFINE_GUID
+#define DEFINE_GUID(name,l,w1,w2,b1,b2,b3,b4,b5,b6,b7,b8) EXTERN_C const GUID DECLSPEC_SELECTANY name = { l, w1, w2, { b1, b2, b3, b4, b5, b6, b7, b8 } }
+// FIXME: defined in evr.lib?
+DEFINE_GUID(MR_BUFFER_SERVICE, 0xa562248c, 0x9ac6, 0x4ffc, 0x9f, 0xba, 0x3a, 0xf8, 0xf8, 0xad, 0x1a, 0x4d );
+#endif
+
+// fixed size blocks recycled without heap allocation after warm up. used by allocate_shared, whose block(control block + object) size is a constant
+class BlockPool
+{
+public:
+    static BlockPool& instance() {
+        static auto p = new BlockPool(); // never destroyed, frames may be released after exit
+        return *p;
+    }
+
+    void* get(size_t size) {
+        {
+            std::lock_guard<std::mutex> lock(mtx_);
+            if (size_ == 0)
+                size_ = size;
+            if (size == size_ && head_) {
+                auto b = head_;
+                head_ = b->next;
+                return b;
+            }
+        }
+        return ::operator new(std::max<size_t>(size, sizeof(Block)));
+    }
+
+    void put(void* p, size_t size) {
+        {
+            std::lock_guard<std::mutex> lock(mtx_);
+            if (size == size_) {
+                auto b = static_cast<Block*>(p);
+                b->next = head_;
+                head_ = b;
+                return;
+            }
+        }
+        ::operator delete(p);
+    }
+private:
+    struct Block {
+        Block* next;
+    };
+    std::mutex mtx_;
+    size_t size_ = 0;
+    Block* head_ = nullptr;
+};
+
+template<typename T>
+struct BlockPoolAllocator {
+    using value_type = T;
+    BlockPoolAllocator() = default;
+    template<typename U> BlockPoolAllocator(const BlockPoolAllocator<U>&) {}
+    T* allocate(size_t n) { return static_cast<T*>(BlockPool::instance().get(n * sizeof(T))); }
+    void deallocate(T* p, size_t n) { BlockPool::instance().put(p, n * sizeof(T)); }
+    template<typename U> bool operator==(const BlockPoolAllocator<U>&) const { return true; }
+    template<typename U> bool operator!=(const BlockPoolAllocator<U>&) const { return false; }
+};
+
+static std::atomic<uint64_t> buffer_locks_{0};
+
+class MFBuffer2DState;
+class MFPlaneBuffer2D final: public Buffer2D
+{
+    MFBuffer2DState* lazy_ = nullptr; // lock on 1st access
+    const Byte* data_ = nullptr; // not writable, so const Byte*. offset in buffer if lazy
+    size_t size_ = 0;
+    size_t stride_ = 0;
+public:
+    void set(const uint8_t* data, size_t size, int stride) {
+        lazy_ = nullptr;
+        data_ = data;
+        size_ = size;
+        stride_ = stride;
+    }
+    void setLazy(MFBuffer2DState* state, size_t offset, size_t size, int stride) {
+        lazy_ = state;
+        data_ = (const Byte*)offset;
+        size_ = size;
+        stride_ = stride;
+    }
+    const Byte* constData() const override;
+    size_t size() const override { return size_;}
+    size_t stride() const override { return stride_;}
+};
+
+// buffer lock and plane wrappers in 1 pooled block. planes share the block's ref count, the buffer is unlocked when the last plane is released
+class MFBuffer2DState { // TODO: hold tracked sample?
+    ComPtr<IMFMediaBuffer> buf_;
+    ComPtr<IMF2DBuffer> buf2d_;
+    std::once_flag lock_once_;
+    BYTE* data_ = nullptr;
+    bool locked_ = false;
+public:
+    MFPlaneBuffer2D planes[4];
+
+    MFBuffer2DState(ComPtr<IMFMediaBuffer> b) : buf_(b) {}
+    MFBuffer2DState(ComPtr<IMF2DBuffer> b) : buf2d_(b) {}
+    MFBuffer2DState(ComPtr<IMF2DBuffer2> b) : buf2d_(b) {}
+    ~MFBuffer2DState() {
+        if (!locked_)
+            return;
+        if (buf2d_)
+            MS_WARN(buf2d_->Unlock2D());
+        if (buf_)
+            MS_WARN(buf_->Unlock());
+    }
+    // called after a successful lock by setBuffersTo()
+    void setLocked() {
+        locked_ = true;
+        buffer_locks_++;
+    }
+    // lock IMFMediaBuffer on 1st call
+    BYTE* data() {
+        std::call_once(lock_once_, [this]{
+            if (SUCCEEDED(buf_->Lock(&data_, nullptr, nullptr)))
+                setLocked();
+        });
+        return data_;
+    }
+};
+
+const Byte* MFPlaneBuffer2D::constData() const
+{
+    if (!lazy_)
+        return data_;
+    auto data = lazy_->data();
+    return data ? data + (size_t)data_ : nullptr;
+}
+
+template<typename B>
+std::shared_ptr<MFBuffer2DState> make_state(ComPtr<B> b)
+{
+    return std::allocate_shared<MFBuffer2DState>(BlockPoolAllocator<MFBuffer2DState>(), b);
+}
+
+uint64_t buffer_locks()
+{
+    return buffer_locks_;
+}
+enum class Conversion {
+    None,
+    UV8, // nv12 => yuv420p
+    UV16, // p010 => yuv420p10le
+    YUY2, // yuy2 => yuv422p
+};
+
+static Conversion conversion_of(const VideoFormat& from, const VideoFormat& to, int* shift = nullptr)
+{
+    if (from == VideoFormat(PixelFormat::NV12) && to == VideoFormat(PixelFormat::YUV420P))
+        return Conversion::UV8;
+    if (from == VideoFormat(PixelFormat::P010LE) && to == VideoFormat(PixelFormat::YUV420P10LE)) {
+        if (shift)
+            *shift = 6; // p010 samples are in high bits
+        return Conversion::UV16;
+    }
+    if (from == VideoFormat(PixelFormat::YUYV422) && to == VideoFormat(PixelFormat::YUV422P))
+        return Conversion::YUY2;
+    return Conversion::None;
+}
+
+bool can_convert(const VideoFormat& from, const VideoFormat& to)
+{
+    return conversion_of(from, to) != Conversion::None;
+}
+
+// uninitialized frame plane, pitch is 32 bytes aligned
+static std::shared_ptr<ByteArrayBuffer2D> newPlane(int bytes, int rows, uint8_t** data, int* pitch)
+{
+    *pitch = (bytes + 31) & ~31;
+    auto b = std::make_shared<ByteArrayBuffer2D>(*pitch, rows, nullptr);
+    *data = b->data();
+    return b;
+}
+
+// rows of band i in n bands of a plane
+static void band_rows(int rows, int i, int n, int* begin, int* count)
+{
+    *begin = int((int64_t)rows * i / n);
+    *count = int((int64_t)rows * (i + 1) / n) - *begin;
+}
+
+// copy planes in layout starting at base to new frame planes in frame format. threads > 1: split planes into row bands copied concurrently
+static bool convertTo(VideoFrame& frame, const uint8_t* base, const PlaneLayout& layout, int threads)
+{
+    const auto& fmt = frame.format();
+    int shift = 0;
+    const auto conv = conversion_of(VideoFormat(layout.format), fmt, &shift);
+    if (conv == Conversion::None)
+        return false;
+    std::shared_ptr<ByteArrayBuffer2D> planes[3];
+    uint8_t* d[3]{};
+    int pitch[3]{};
+    for (int plane = 0; plane < 3; ++plane)
+        planes[plane] = newPlane(fmt.bytesPerLine(layout.width, plane), fmt.height(layout.height, plane), &d[plane], &pitch[plane]);
+    const int uv_width = (layout.width + 1) / 2;
+    parallel_bands(threads, [&](int band) {
+        int y = 0, h = 0, uvy = 0, uvh = 0;
+        band_rows(layout.rows[0], band, threads, &y, &h);
+        band_rows(layout.rows[1], band, threads, &uvy, &uvh);
+        const auto s0 = base + layout.offset[0] + (ptrdiff_t)y * layout.pitch[0];
+        const auto s1 = base + layout.offset[1] + (ptrdiff_t)uvy * layout.pitch[1];
+        switch (conv) {
+        case Conversion::UV8:
+            copy_plane(s0, layout.pitch[0], d[0] + (ptrdiff_t)y * pitch[0], pitch[0], layout.width, h);
+            deinterleave_uv8(s1, layout.pitch[1], d[1] + (ptrdiff_t)uvy * pitch[1], pitch[1], d[2] + (ptrdiff_t)uvy * pitch[2], pitch[2], uv_width, uvh);
+            break;
+        case Conversion::UV16:
+            shift_plane16(s0, layout.pitch[0], d[0] + (ptrdiff_t)y * pitch[0], pitch[0], layout.width, h, shift);
+            deinterleave_uv16(s1, layout.pitch[1], d[1] + (ptrdiff_t)uvy * pitch[1], pitch[1], d[2] + (ptrdiff_t)uvy * pitch[2], pitch[2], uv_width, uvh, shift);
+            break;
+        case Conversion::YUY2: // 1 source plane, output chroma rows are the same as luma
+            yuy2_to_planar(s0, layout.pitch[0], d[0] + (ptrdiff_t)y * pitch[0], pitch[0], d[1] + (ptrdiff_t)y * pitch[1], pitch[1], d[2] + (ptrdiff_t)y * pitch[2], pitch[2], uv_width * 2, h);
+            break;
+        default:
+            break;
+        }
+    });
+    for (const auto& p : planes)
+        frame.addBuffer(p);
+    return true;
+}
+
+// uncached: buf is a mapped gpu surface(write combining memory), copied by streaming loads if supported
+// threads: number of row bands copied concurrently
+bool setBuffersTo(VideoFrame& frame, ComPtr<IMFMediaBuffer> buf, const PlaneLayout& type_layout, bool copy = false, bool uncached = false, int threads = 1)
+{
+    BYTE* data = nullptr;
+    BYTE* base = nullptr; // buffer start
+    DWORD len = 0;
+    LONG pitch = 0;
+    ComPtr<IMF2DBuffer> buf2d;
+    ComPtr<IMF2DBuffer2> buf2d2;
+    std::shared_ptr<MFBuffer2DState> bs;
+    bool lazy = false;
+
+    if (SUCCEEDED(buf.As(&buf2d2))) { // usually d3d buffer
+        bs = make_state(buf2d2);
+        MS_ENSURE(buf2d2->Lock2DSize(MF2DBuffer_LockFlags_Read, &data, &pitch, &base, &len), false);
+        bs->setLocked();
+    } else if (SUCCEEDED(buf.As(&buf2d))) { // usually d3d buffer
+        bs = make_state(buf2d);
+        MS_ENSURE(buf2d->Lock2D(&data, &pitch), false); // data is scanline 0
+        bs->setLocked();
+    } else if (!copy && type_layout.pitch[0] > 0) { // software decoder, layout is known. lock when plane data is accessed, so dropped frames never lock
+        bs = make_state(buf);
+        lazy = true;
+    } else { // slower than 2d if is 2d
+        bs = make_state(buf);
+        MS_ENSURE(buf->Lock(&data, nullptr, &len), false);
+        bs->setLocked();
+        base = data;
+    }
+    // d3d surface pitch can be different from MF_MT_DEFAULT_STRIDE
+    PlaneLayout surface_layout;
+    if (pitch != 0 && pitch != type_layout.pitch[0]) {
+        surface_layout = plane_layout(VideoFormat(type_layout.format), type_layout.width, type_layout.height, (int)pitch);
+        surface_layout.format = type_layout.format;
+    }
+    const auto& layout = surface_layout.planes > 0 ? surface_layout : type_layout;
+    if (lazy) {
+        for (int plane = 0; plane < layout.planes; ++plane) {
+            bs->planes[plane].setLazy(bs.get(), layout.offset[plane], layout.size[plane], layout.pitch[plane]);
+            frame.addBuffer(std::shared_ptr<Buffer2D>(bs, &bs->planes[plane]));
+        }
+        return true;
+    }
+    if (!base)
+        base = data - layout.offset[0];
+    if (layout.format != PixelFormat::Unknown && !(frame.format() == VideoFormat(layout.format))) // copy and convert in 1 pass
+        return convertTo(frame, base, layout, threads);
+    // frame buffers can not be bottom up, so copy from the top row with negative strides
+    copy = copy || layout.pitch[0] < 0;
+    uncached = uncached && has_streaming_load();
+    if (copy && (uncached || threads > 1)) {
+        const auto copy_rows = uncached ? copy_plane_uncached : copy_plane;
+        uint8_t* d[4]{};
+        int pitch[4]{};
+        int bytes[4]{};
+        for (int plane = 0; plane < layout.planes; ++plane) {
+            bytes[plane] = std::min<int>(frame.format().bytesPerLine(layout.width, plane), std::abs(layout.pitch[plane]));
+            frame.addBuffer(newPlane(bytes[plane], layout.rows[plane], &d[plane], &pitch[plane]));
+        }
+        parallel_bands(threads, [&](int band) {
+            for (int plane = 0; plane < layout.planes; ++plane) {
+                int y = 0, h = 0;
+                band_rows(layout.rows[plane], band, threads, &y, &h);
+                copy_rows(base + layout.offset[plane] + (ptrdiff_t)y * layout.pitch[plane], layout.pitch[plane], d[plane] + (ptrdiff_t)y * pitch[plane], pitch[plane], bytes[plane], h);
+            }
+        });
+        return true;
+    }
+    const uint8_t* da[4]{};
+    int strides[4]{};
+    for (int plane = 0; plane < layout.planes; ++plane) {
+        const auto p = base + layout.offset[plane];
+        if (copy) {
+            da[plane] = p;
+            strides[plane] = layout.pitch[plane];
+        } else {
+            bs->planes[plane].set(p, layout.size[plane], layout.pitch[plane]);
+            frame.addBuffer(std::shared_ptr<Buffer2D>(bs, &bs->planes[plane])); // aliasing, no allocation
+        }
+    }
+    if (copy)
+        frame.setBuffers(da, strides);
+    return true;
+}
+
+bool to(VideoFrame& frame, ComPtr<IMFSample> sample, const PlaneLayout& layout, int copy, int threads)
+{
+    LONGLONG t = 0;
+    if (SUCCEEDED(sample->GetSampleTime(&t)))
+        frame.setTimestamp(from_mf_time(t));
+    DWORD nb_bufs = 0;
+    MS_ENSURE(sample->GetBufferCount(&nb_bufs), false);
+    const auto& fmt = frame.format();
+    const bool convert = layout.format != PixelFormat::Unknown && !(fmt == VideoFormat(layout.format)); // planes of all formats to convert are in 1 buffer
+    if (convert)
+        copy = std::max<int>(copy, 2);
+    const bool contiguous = convert || fmt.planeCount() > (int)nb_bufs;
+    for (DWORD i = 0; i < nb_bufs; ++i) {
+        ComPtr<IMFMediaBuffer> buf;
+        MS_ENSURE(sample->GetBufferByIndex(i, &buf), false);
+        ComPtr<IMFDXGIBuffer> dxgibuf; // MFCreateDXGISurfaceBuffer
+        struct {
+            ID3D11Texture2D* tex;
+            UINT index; // subresource
+            ComPtr<ID3D11Texture2D> sp; // auto release
+        } texinfo;
+        void* opaque = nullptr;
+        if (SUCCEEDED(buf.As(&dxgibuf))) {
+            MS_WARN(dxgibuf->GetResource(IID_PPV_ARGS(&texinfo.sp)));
+            UINT subidx = 0;
+            MS_WARN(dxgibuf->GetSubresourceIndex(&subidx));
+            texinfo.index = subidx;
+            texinfo.tex = texinfo.sp.Get();
+            opaque = &texinfo;
+        }
+#if (MS_API_DESKTOP+0)
+        ComPtr<IDirect3DSurface9> d3d9surf; // MFCreateDXSurfaceBuffer
+        //ComPtr<IMFGetService> getsv; MS_WARN(buf.As(&getsv)); IMFGetService::GetService
+        if (!opaque && SUCCEEDED(MFGetService(buf.Get(), MR_BUFFER_SERVICE, IID_PPV_ARGS(&d3d9surf))))
+            opaque = d3d9surf.Get();
+#endif
+        if (opaque) {
+            if (copy > 0) {
+                frame.setNativeBuffer(nullptr);
+                setBuffersTo(frame, buf, layout, copy > 1, true, threads);
+                return true;
+            }
+            // d3d: The sample will contain exactly one media buffer
+            auto nbuf = frame.nativeBuffer();
+            if (nbuf) {
+                auto pool = (NativeVideoBufferPool*)nbuf->map(NativeVideoBuffer::Original, nullptr);
+                if (pool) {
+                    frame.setNativeBuffer(pool->getBuffer(opaque, [sample](){
+                        (void)sample; // recyle when no one holds d3d native buffer
+                    }));
+                    return true;
+                }
+            }
+        }
+
+        DWORD len = 0;
+        MS_ENSURE(buf->GetCurrentLength(&len), false);
+        if (contiguous) {
+            setBuffersTo(frame, buf, layout, copy > 0, false, threads);
+        } else {
+            ComPtr<IMF2DBuffer> buf2d;
+            if (SUCCEEDED(buf.As(&buf2d))) {
+            }
+            if (buf2d) {
+                frame.addBuffer(to(buf2d), i);
+            } else {
+                // TODO: no copy. Buffer2DRef to(ComPtr<IMFBuffer> b, int stride, int height, ptrdiff_t offset = 0, int size = -1);
+                BYTE* data = nullptr;
+                MS_ENSURE(buf->Lock(&data, nullptr, &len), false);
+                frame.addBuffer(std::make_shared<ByteArrayBuffer2D>(len/layout.rows[i], layout.rows[i], data));
+                buf->Unlock();
+            }
+        }
+    }
+    return true;
+}
+} // namespace MF
+MDK_NS_END
@@ -13,13 +13,8 @@
 #   define _WIN32_WINNT 0x0A00
 # endif
 #include "base/ms/MFGlue.h"
-#include "base/ByteArrayBuffer.h"
 #include "mdk/MediaInfo.h"
 #include "mdk/VideoFrame.h"
-#if (MS_API_DESKTOP+0)
-#include <d3d9.h>
-#endif
-#include <d3d11.h>
 #include <mfidl.h>
 #if __has_include(<Mferror.h>) // msvc
 # include <Mferror.h>
@@ -264,151 +259,24 @@ bool from(const VideoFormat& fmt, IMFAttributes* a)
 {
     return false;
 }
-#undef DEFINE_GUID
-#define DEFINE_GUID(name,l,w1,w2,b1,b2,b3,b4,b5,b6,b7,b8) EXTERN_C const GUID DECLSPEC_SELECTANY name = { l, w1, w2, { b1, b2, b3, b4, b5, b6, b7, b8 } }
-// FIXME: defined in evr.lib?
-DEFINE_GUID(MR_BUFFER_SERVICE, 0xa562248c, 0x9ac6, 0x4ffc, 0x9f, 0xba, 0x3a, 0xf8, 0xf8, 0xad, 0x1a, 0x4d );
-
-class MFBuffer2DState { // TODO: hold tracked sample?
-    ComPtr<IMFMediaBuffer> buf_;
-    ComPtr<IMF2DBuffer> buf2d_;
-public:
-    MFBuffer2DState(ComPtr<IMFMediaBuffer> b) : buf_(b) {}
-    MFBuffer2DState(ComPtr<IMF2DBuffer> b) : buf2d_(b) {}
-    MFBuffer2DState(ComPtr<IMF2DBuffer2> b) : buf2d_(b) {}
-    ~MFBuffer2DState() {
-        if (buf2d_)
-            MS_WARN(buf2d_->Unlock2D());
-        if (buf_)
-            MS_WARN(buf_->Unlock());
-    }
-};
-
-class MFPlaneBuffer2D final: public Buffer2D
-{
-    const Byte* const data_; // not writable, so const Byte*
-    size_t size_;
-    size_t stride_;
-    std::shared_ptr<MFBuffer2DState> state_;
-public:
-    MFPlaneBuffer2D(const uint8_t* data, size_t size, int stride, std::shared_ptr<MFBuffer2DState> state)
-        : data_(data), size_(size), stride_(stride), state_(state)
-    {}
-    const Byte* constData() const override {return data_;}
-    size_t size() const override { return size_;}
-    size_t stride() const override { return stride_;}
-};
-
-bool setBuffersTo(VideoFrame& frame, ComPtr<IMFMediaBuffer> buf, int stride_x = 0, int stride_y = 0, bool copy = false)
-{
-    BYTE* data = nullptr;
-    DWORD len = 0;
-    LONG pitch = 0;
-    ComPtr<IMF2DBuffer> buf2d;
-    ComPtr<IMF2DBuffer2> buf2d2;
-    std::shared_ptr<MFBuffer2DState> bs;
-
-    if (SUCCEEDED(buf.As(&buf2d2))) { // usually d3d buffer
-        bs = std::make_shared<MFBuffer2DState>(buf2d2);
-        BYTE* start = nullptr; // required
-        MS_ENSURE(buf2d2->Lock2DSize(MF2DBuffer_LockFlags_Read, &data, &pitch, &start, &len), false);
-    } else if (SUCCEEDED(buf.As(&buf2d))) { // usually d3d buffer
-        bs = std::make_shared<MFBuffer2DState>(buf2d);
-        MS_ENSURE(buf2d->Lock2D(&data, &pitch), false);
-    } else { // slower than 2d if is 2d
-        bs = std::make_shared<MFBuffer2DState>(buf);
-        MS_ENSURE(buf->Lock(&data, nullptr, &len), false);
-    }
-    if (pitch <= 0)
-        pitch = stride_x;
-    const uint8_t* da[] = {data, nullptr, nullptr}; // assume no padding data if da[i>0] == null
-    int strides[] = {(int)pitch, (int)pitch, (int)pitch};
-    const auto& fmt = frame.format();
-    for (int plane = 0; plane < fmt.planeCount(); ++plane) {
-        if (pitch <= 0)
-            pitch = frame.effectiveBytesPerLine(plane);
-        const size_t bytes = pitch*fmt.height(stride_y, plane);
-        if (copy)
-            da[plane] = data;
-        else
-            frame.addBuffer(std::make_shared<MFPlaneBuffer2D>(data, bytes, (int)pitch, bs)); // same stride for each plane?
-        data += bytes;
-    }
-    if (copy)
-        frame.setBuffers(da, strides);
-    return true;
-}
 
-bool to(VideoFrame& frame, ComPtr<IMFSample> sample, int stride_x, int stride_y, int copy)
+bool to(PlaneLayout& layout, const IMFAttributes* ca)
 {
-    LONGLONG t = 0;
-    if (SUCCEEDED(sample->GetSampleTime(&t)))
-        frame.setTimestamp(from_mf_time(t));
-    DWORD nb_bufs = 0;
-    MS_ENSURE(sample->GetBufferCount(&nb_bufs), false);
-    const auto& fmt = frame.format();
-    const bool contiguous = fmt.planeCount() > (int)nb_bufs;
-    for (DWORD i = 0; i < nb_bufs; ++i) {
-        ComPtr<IMFMediaBuffer> buf;
-        MS_ENSURE(sample->GetBufferByIndex(i, &buf), false);
-        ComPtr<IMFDXGIBuffer> dxgibuf; // MFCreateDXGISurfaceBuffer
-        struct {
-            ID3D11Texture2D* tex;
-            ComPtr<ID3D11Texture2D> sp; // auto release
-        } texinfo;
-        void* opaque = nullptr;
-        if (SUCCEEDED(buf.As(&dxgibuf))) {
-            MS_WARN(dxgibuf->GetResource(IID_PPV_ARGS(&texinfo.sp)));
-            UINT subidx = 0;
-            MS_WARN(dxgibuf->GetSubresourceIndex(&subidx));
-            texinfo.index = subidx;
-            texinfo.tex = texinfo.sp.Get();
-            opaque = &texinfo;
-        }
-#if (MS_API_DESKTOP+0)
-        ComPtr<IDirect3DSurface9> d3d9surf; // MFCreateDXSurfaceBuffer
-        //ComPtr<IMFGetService> getsv; MS_WARN(buf.As(&getsv)); IMFGetService::GetService
-        if (!opaque && SUCCEEDED(MFGetService(buf.Get(), MR_BUFFER_SERVICE, IID_PPV_ARGS(&d3d9surf))))
-            opaque = d3d9surf.Get();
-#endif
-        if (opaque) {
-            if (copy > 0) {
-                frame.setNativeBuffer(nullptr);
-                setBuffersTo(frame, buf, stride_x, stride_y, copy > 1);
-                return true;
-            }
-            // d3d: The sample will contain exactly one media buffer
-            auto nbuf = frame.nativeBuffer();
-            if (nbuf) {
-                auto pool = (NativeVideoBufferPool*)nbuf->map(NativeVideoBuffer::Original, nullptr);
-                if (pool) {
-                    frame.setNativeBuffer(pool->getBuffer(opaque, [sample](){
-                        (void)sample; // recyle when no one holds d3d native buffer
-                    }));
-                    return true;
-                }
-            }
-        }
-
-        DWORD len = 0;
-        MS_ENSURE(buf->GetCurrentLength(&len), false);
-        if (contiguous) {
-            setBuffersTo(frame, buf, stride_x, stride_y, copy > 0);
-        } else {
-            ComPtr<IMF2DBuffer> buf2d;
-            if (SUCCEEDED(buf.As(&buf2d))) {
-            }
-            if (buf2d) {
-                frame.addBuffer(to(buf2d), i);
-            } else {
-                // TODO: no copy. Buffer2DRef to(ComPtr<IMFBuffer> b, int stride, int height, ptrdiff_t offset = 0, int size = -1);
-                BYTE* data = nullptr;
-                MS_ENSURE(buf->Lock(&data, nullptr, &len), false);
-                frame.addBuffer(std::make_shared<ByteArrayBuffer2D>(len/fmt.height(stride_y, i), fmt.height(stride_y, i), data));
-                buf->Unlock();
-            }
-        }
-    }
+    auto a = const_cast<IMFAttributes*>(ca);
+    VideoFormat fmt;
+    if (!to(fmt, a))
+        return false;
+    UINT64 dim = 0;
+    MS_ENSURE(a->GetUINT64(MF_MT_FRAME_SIZE, &dim), false);
+    UINT32 w = 0, h = 0;
+    Unpack2UINT32AsUINT64(dim, &w, &h);
+    UINT32 stride = 0; // LONG stored as UINT32
+    if (FAILED(a->GetUINT32(MF_MT_DEFAULT_STRIDE, &stride)))
+        stride = 0;
+    layout = plane_layout(fmt, (int)w, (int)h, (INT32)stride);
+    GUID subtype;
+    if (SUCCEEDED(a->GetGUID(MF_MT_SUBTYPE, &subtype)))
+        to_pixfmt(&layout.format, subtype);
     return true;
 }
 
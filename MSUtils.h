@@ -31,6 +31,7 @@
 #endif
 #pragma pop_macro("_WIN32_WINNT")
 using namespace Microsoft::WRL; //ComPtr
+#include "ComBase.h"
 
 // TODO: define MS_ERROR_STR before including this header to handle module specific errors?
 #define MS_ENSURE(f, ...) MS_CHECK(f, return __VA_ARGS__;)
@@ -51,4 +52,4 @@ using namespace Microsoft::WRL; //ComPtr
 using module_t = std::remove_pointer<HMODULE>::type;
 using dll_t = std::unique_ptr<module_t, decltype(&FreeLibrary)>;
 
-uint32_t to_fourcc(const GUID id);
\ No newline at end of file
+uint32_t to_fourcc(const GUID id);
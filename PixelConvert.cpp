@@ -0,0 +1,416 @@
+/*
+ * Copyright (c) 2022 WangBin <wbsecg1 at gmail.com>
+ * This file is part of MDK MFT plugin
+ * Source code: https://github.com/wang-bin/mdk-mft
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+#include "PixelConvert.h"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <thread>
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_IX86) || defined(__i386__)
+# include <emmintrin.h>
+# include <smmintrin.h>
+# define PIXCONV_SSE2 1
+// kernels are built for the target isa and selected at runtime, so i686 builds without -msse2 can use them too
+# if (_MSC_VER + 0)
+#   include <intrin.h>
+#   define PIXCONV_TARGET_SSE2
+#   define PIXCONV_TARGET_SSE41
+# else
+#   include <cpuid.h>
+#   define PIXCONV_TARGET_SSE2 __attribute__((target("sse2")))
+#   define PIXCONV_TARGET_SSE41 __attribute__((target("sse4.1")))
+# endif
+#elif defined(__aarch64__) || defined(_M_ARM64)
+# include <arm_neon.h>
+# define PIXCONV_NEON 1
+#endif
+
+MDK_NS_BEGIN
+namespace {
+// scalar reference. simd kernels process the leading multiple of vector width and call these for the rest
+void shift16_c(const uint8_t* src, uint8_t* dst, int width, int shift)
+{
+    auto s = (const uint16_t*)src;
+    auto d = (uint16_t*)dst;
+    for (int x = 0; x < width; ++x)
+        d[x] = uint16_t(s[x] >> shift);
+}
+
+void uv8_c(const uint8_t* src, uint8_t* u, uint8_t* v, int width)
+{
+    for (int x = 0; x < width; ++x) {
+        u[x] = src[2*x];
+        v[x] = src[2*x+1];
+    }
+}
+
+void uv16_c(const uint8_t* src, uint8_t* u, uint8_t* v, int width, int shift)
+{
+    auto s = (const uint16_t*)src;
+    auto du = (uint16_t*)u;
+    auto dv = (uint16_t*)v;
+    for (int x = 0; x < width; ++x) {
+        du[x] = uint16_t(s[2*x] >> shift);
+        dv[x] = uint16_t(s[2*x+1] >> shift);
+    }
+}
+
+void yuy2_c(const uint8_t* src, uint8_t* y, uint8_t* u, uint8_t* v, int width)
+{
+    for (int x = 0; x < width/2; ++x) {
+        y[2*x] = src[4*x];
+        u[x] = src[4*x+1];
+        y[2*x+1] = src[4*x+2];
+        v[x] = src[4*x+3];
+    }
+}
+
+#if (PIXCONV_SSE2 + 0)
+PIXCONV_TARGET_SSE2 void shift16_sse2(const uint8_t* src, uint8_t* dst, int width, int shift)
+{
+    const auto sh = _mm_cvtsi32_si128(shift);
+    int x = 0;
+    for (; x + 8 <= width; x += 8)
+        _mm_storeu_si128((__m128i*)(dst + 2*x), _mm_srl_epi16(_mm_loadu_si128((const __m128i*)(src + 2*x)), sh));
+    shift16_c(src + 2*x, dst + 2*x, width - x, shift);
+}
+
+PIXCONV_TARGET_SSE2 void uv8_sse2(const uint8_t* src, uint8_t* u, uint8_t* v, int width)
+{
+    const auto mask = _mm_set1_epi16(0x00ff);
+    int x = 0;
+    for (; x + 16 <= width; x += 16) {
+        const auto a = _mm_loadu_si128((const __m128i*)(src + 2*x));
+        const auto b = _mm_loadu_si128((const __m128i*)(src + 2*x + 16));
+        _mm_storeu_si128((__m128i*)(u + x), _mm_packus_epi16(_mm_and_si128(a, mask), _mm_and_si128(b, mask)));
+        _mm_storeu_si128((__m128i*)(v + x), _mm_packus_epi16(_mm_srli_epi16(a, 8), _mm_srli_epi16(b, 8)));
+    }
+    uv8_c(src + 2*x, u + x, v + x, width - x);
+}
+
+PIXCONV_TARGET_SSE2 void uv16_sse2(const uint8_t* src, uint8_t* u, uint8_t* v, int width, int shift)
+{
+    const auto sh = _mm_cvtsi32_si128(shift);
+    int x = 0;
+    for (; x + 8 <= width; x += 8) {
+        const auto a = _mm_loadu_si128((const __m128i*)(src + 4*x));
+        const auto b = _mm_loadu_si128((const __m128i*)(src + 4*x + 16));
+        // sign extended 16bit values are packed without saturation, and the bits are the same as unsigned input
+        const auto ua = _mm_srai_epi32(_mm_slli_epi32(a, 16), 16);
+        const auto ub = _mm_srai_epi32(_mm_slli_epi32(b, 16), 16);
+        const auto va = _mm_srai_epi32(a, 16);
+        const auto vb = _mm_srai_epi32(b, 16);
+        _mm_storeu_si128((__m128i*)(u + 2*x), _mm_srl_epi16(_mm_packs_epi32(ua, ub), sh));
+        _mm_storeu_si128((__m128i*)(v + 2*x), _mm_srl_epi16(_mm_packs_epi32(va, vb), sh));
+    }
+    uv16_c(src + 4*x, u + 2*x, v + 2*x, width - x, shift);
+}
+
+PIXCONV_TARGET_SSE2 void yuy2_sse2(const uint8_t* src, uint8_t* y, uint8_t* u, uint8_t* v, int width)
+{
+    const auto mask = _mm_set1_epi16(0x00ff);
+    int x = 0; // luma samples
+    for (; x + 16 <= width; x += 16) {
+        const auto a = _mm_loadu_si128((const __m128i*)(src + 2*x)); // y0 u0 y1 v0 ...
+        const auto b = _mm_loadu_si128((const __m128i*)(src + 2*x + 16));
+        _mm_storeu_si128((__m128i*)(y + x), _mm_packus_epi16(_mm_and_si128(a, mask), _mm_and_si128(b, mask)));
+        const auto c = _mm_packus_epi16(_mm_srli_epi16(a, 8), _mm_srli_epi16(b, 8)); // u0 v0 u1 v1 ...
+        const auto uv = _mm_packus_epi16(_mm_and_si128(c, mask), _mm_srli_epi16(c, 8)); // u0..u7 v0..v7
+        _mm_storel_epi64((__m128i*)(u + x/2), uv);
+        _mm_storel_epi64((__m128i*)(v + x/2), _mm_srli_si128(uv, 8));
+    }
+    yuy2_c(src + 2*x, y + x, u + x/2, v + x/2, width - x);
+}
+
+// write combining memory is read in 16 byte aligned blocks by streaming loads, which fill a line of the read buffer instead of reading the whole line for each load.
+// data is stored to a small bounce buffer which stays in L1, then copied to the destination with regular(cached) stores
+PIXCONV_TARGET_SSE41 void copy_uncached_sse41(const uint8_t* src, int src_pitch, uint8_t* dst, int dst_pitch, int bytes, int rows)
+{
+    alignas(64) uint8_t bounce[4096];
+    _mm_mfence(); // previous writes to the surface(e.g. by gpu) are visible
+    for (int i = 0; i < rows; ++i) {
+        auto s = src + (ptrdiff_t)i * src_pitch;
+        auto d = dst + (ptrdiff_t)i * dst_pitch;
+        size_t left = bytes;
+        const size_t head = std::min<size_t>((16 - ((uintptr_t)s & 15)) & 15, left);
+        memcpy(d, s, head);
+        s += head;
+        d += head;
+        left -= head;
+        while (left >= 16) {
+            const size_t n = std::min<size_t>(left & ~size_t(15), sizeof(bounce));
+            size_t x = 0;
+            for (; x + 64 <= n; x += 64) {
+                const auto x0 = _mm_stream_load_si128((__m128i*)(s + x));
+                const auto x1 = _mm_stream_load_si128((__m128i*)(s + x + 16));
+                const auto x2 = _mm_stream_load_si128((__m128i*)(s + x + 32));
+                const auto x3 = _mm_stream_load_si128((__m128i*)(s + x + 48));
+                _mm_store_si128((__m128i*)(bounce + x), x0);
+                _mm_store_si128((__m128i*)(bounce + x + 16), x1);
+                _mm_store_si128((__m128i*)(bounce + x + 32), x2);
+                _mm_store_si128((__m128i*)(bounce + x + 48), x3);
+            }
+            for (; x < n; x += 16)
+                _mm_store_si128((__m128i*)(bounce + x), _mm_stream_load_si128((__m128i*)(s + x)));
+            memcpy(d, bounce, n);
+            s += n;
+            d += n;
+            left -= n;
+        }
+        memcpy(d, s, left);
+    }
+}
+
+void cpuid1(unsigned* ecx, unsigned* edx)
+{
+#if (_MSC_VER + 0)
+    int info[4]{};
+    __cpuid(info, 1);
+    *ecx = info[2];
+    *edx = info[3];
+#else
+    unsigned a = 0, b = 0;
+    if (!__get_cpuid(1, &a, &b, ecx, edx))
+        *ecx = *edx = 0;
+#endif
+}
+
+bool has_sse2()
+{
+#if defined(_M_X64) || defined(__x86_64__)
+    return true;
+#else
+    unsigned c = 0, d = 0;
+    cpuid1(&c, &d);
+    return d & (1 << 26);
+#endif
+}
+
+bool has_sse41()
+{
+    unsigned c = 0, d = 0;
+    cpuid1(&c, &d);
+    return c & (1 << 19);
+}
+#endif // (PIXCONV_SSE2 + 0)
+
+#if (PIXCONV_NEON + 0)
+void shift16_neon(const uint8_t* src, uint8_t* dst, int width, int shift)
+{
+    const auto sh = vdupq_n_s16(int16_t(-shift));
+    int x = 0;
+    for (; x + 8 <= width; x += 8)
+        vst1q_u16((uint16_t*)(dst + 2*x), vshlq_u16(vld1q_u16((const uint16_t*)(src + 2*x)), sh));
+    shift16_c(src + 2*x, dst + 2*x, width - x, shift);
+}
+
+void uv8_neon(const uint8_t* src, uint8_t* u, uint8_t* v, int width)
+{
+    int x = 0;
+    for (; x + 16 <= width; x += 16) {
+        const auto uv = vld2q_u8(src + 2*x);
+        vst1q_u8(u + x, uv.val[0]);
+        vst1q_u8(v + x, uv.val[1]);
+    }
+    uv8_c(src + 2*x, u + x, v + x, width - x);
+}
+
+void uv16_neon(const uint8_t* src, uint8_t* u, uint8_t* v, int width, int shift)
+{
+    const auto sh = vdupq_n_s16(int16_t(-shift));
+    int x = 0;
+    for (; x + 8 <= width; x += 8) {
+        const auto uv = vld2q_u16((const uint16_t*)(src + 4*x));
+        vst1q_u16((uint16_t*)(u + 2*x), vshlq_u16(uv.val[0], sh));
+        vst1q_u16((uint16_t*)(v + 2*x), vshlq_u16(uv.val[1], sh));
+    }
+    uv16_c(src + 4*x, u + 2*x, v + 2*x, width - x, shift);
+}
+
+void yuy2_neon(const uint8_t* src, uint8_t* y, uint8_t* u, uint8_t* v, int width)
+{
+    int x = 0;
+    for (; x + 32 <= width; x += 32) {
+        const auto p = vld4q_u8(src + 2*x); // y0, u, y1, v
+        const uint8x16x2_t yy{{p.val[0], p.val[2]}};
+        vst2q_u8(y + x, yy);
+        vst1q_u8(u + x/2, p.val[1]);
+        vst1q_u8(v + x/2, p.val[3]);
+    }
+    yuy2_c(src + 2*x, y + x, u + x/2, v + x/2, width - x);
+}
+#endif // (PIXCONV_NEON + 0)
+
+struct Kernels {
+    const char* name;
+    void (*shift16)(const uint8_t*, uint8_t*, int, int);
+    void (*uv8)(const uint8_t*, uint8_t*, uint8_t*, int);
+    void (*uv16)(const uint8_t*, uint8_t*, uint8_t*, int, int);
+    void (*yuy2)(const uint8_t*, uint8_t*, uint8_t*, uint8_t*, int);
+    void (*uncached)(const uint8_t*, int, uint8_t*, int, int, int);
+};
+
+const Kernels kKernelsC{"c", shift16_c, uv8_c, uv16_c, yuy2_c, copy_plane};
+
+const Kernels& best_kernels()
+{
+    static const Kernels k = []{
+#if (PIXCONV_SSE2 + 0)
+        if (has_sse2())
+            return Kernels{"sse2", shift16_sse2, uv8_sse2, uv16_sse2, yuy2_sse2, has_sse41() ? copy_uncached_sse41 : copy_plane};
+#elif (PIXCONV_NEON + 0)
+        return Kernels{"neon", shift16_neon, uv8_neon, uv16_neon, yuy2_neon, copy_plane};
+#endif
+        return kKernelsC;
+    }();
+    return k;
+}
+
+std::atomic<const Kernels*> selected_kernels{nullptr};
+
+const Kernels& kernels()
+{
+    const auto k = selected_kernels.load(std::memory_order_relaxed);
+    return k ? *k : best_kernels();
+}
+
+class BandWorkers {
+public:
+    static BandWorkers& instance() {
+        static auto w = new BandWorkers(); // never destroyed, detached workers can run after static objects are destroyed
+        return *w;
+    }
+    void run(std::function<void()>&& task, int workers) {
+        std::lock_guard<std::mutex> lock(mtx_);
+        for (; threads_ < std::min<int>(workers, kMaxThreads); ++threads_)
+            std::thread([this]{ loop(); }).detach();
+        tasks_.push_back(std::move(task));
+        cv_.notify_one();
+    }
+private:
+    void loop() {
+        while (true) {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(mtx_);
+                cv_.wait(lock, [this]{ return !tasks_.empty(); });
+                task = std::move(tasks_.front());
+                tasks_.pop_front();
+            }
+            task();
+        }
+    }
+
+    static constexpr int kMaxThreads = 8;
+    std::mutex mtx_;
+    std::condition_variable cv_;
+    std::deque<std::function<void()>> tasks_;
+    int threads_ = 0;
+};
+} // namespace
+
+void copy_plane(const uint8_t* src, int src_pitch, uint8_t* dst, int dst_pitch, int bytes, int rows)
+{
+    if (src_pitch == dst_pitch && src_pitch == bytes) {
+        memcpy(dst, src, size_t(bytes) * rows);
+        return;
+    }
+    for (int i = 0; i < rows; ++i)
+        memcpy(dst + (ptrdiff_t)i * dst_pitch, src + (ptrdiff_t)i * src_pitch, bytes);
+}
+
+void copy_plane_uncached(const uint8_t* src, int src_pitch, uint8_t* dst, int dst_pitch, int bytes, int rows)
+{
+    kernels().uncached(src, src_pitch, dst, dst_pitch, bytes, rows);
+}
+
+bool has_streaming_load()
+{
+    return kernels().uncached != copy_plane;
+}
+
+void shift_plane16(const uint8_t* src, int src_pitch, uint8_t* dst, int dst_pitch, int width, int rows, int shift)
+{
+    if (shift == 0) {
+        copy_plane(src, src_pitch, dst, dst_pitch, width * 2, rows);
+        return;
+    }
+    const auto f = kernels().shift16;
+    for (int i = 0; i < rows; ++i)
+        f(src + (ptrdiff_t)i * src_pitch, dst + (ptrdiff_t)i * dst_pitch, width, shift);
+}
+
+void deinterleave_uv8(const uint8_t* src, int src_pitch, uint8_t* u, int u_pitch, uint8_t* v, int v_pitch, int width, int rows)
+{
+    const auto f = kernels().uv8;
+    for (int i = 0; i < rows; ++i)
+        f(src + (ptrdiff_t)i * src_pitch, u + (ptrdiff_t)i * u_pitch, v + (ptrdiff_t)i * v_pitch, width);
+}
+
+void deinterleave_uv16(const uint8_t* src, int src_pitch, uint8_t* u, int u_pitch, uint8_t* v, int v_pitch, int width, int rows, int shift)
+{
+    const auto f = kernels().uv16;
+    for (int i = 0; i < rows; ++i)
+        f(src + (ptrdiff_t)i * src_pitch, u + (ptrdiff_t)i * u_pitch, v + (ptrdiff_t)i * v_pitch, width, shift);
+}
+
+void yuy2_to_planar(const uint8_t* src, int src_pitch, uint8_t* y, int y_pitch, uint8_t* u, int u_pitch, uint8_t* v, int v_pitch, int width, int rows)
+{
+    const auto f = kernels().yuy2;
+    for (int i = 0; i < rows; ++i)
+        f(src + (ptrdiff_t)i * src_pitch, y + (ptrdiff_t)i * y_pitch, u + (ptrdiff_t)i * u_pitch, v + (ptrdiff_t)i * v_pitch, width);
+}
+
+void parallel_bands(int bands, const std::function<void(int band)>& f)
+{
+    if (bands <= 1) {
+        f(0);
+        return;
+    }
+    std::mutex mtx;
+    std::condition_variable cv;
+    int left = bands - 1;
+    auto& workers = BandWorkers::instance();
+    for (int i = 1; i < bands; ++i) {
+        workers.run([&, i]{
+            f(i);
+            std::lock_guard<std::mutex> lock(mtx);
+            if (--left == 0)
+                cv.notify_one();
+        }, bands - 1);
+    }
+    f(0);
+    std::unique_lock<std::mutex> lock(mtx);
+    cv.wait(lock, [&]{ return left == 0; });
+}
+
+const char* pixel_convert_impl()
+{
+    return kernels().name;
+}
+
+bool select_pixel_convert_impl(const char* name)
+{
+    if (!name || !*name) {
+        selected_kernels = nullptr;
+        return true;
+    }
+    if (strcmp(name, best_kernels().name) == 0)
+        selected_kernels = &best_kernels();
+    else if (strcmp(name, kKernelsC.name) == 0)
+        selected_kernels = &kKernelsC;
+    else
+        return false;
+    return true;
+}
+MDK_NS_END
@@ -0,0 +1,39 @@
+/*
+ * Copyright (c) 2022 WangBin <wbsecg1 at gmail.com>
+ * This file is part of MDK MFT plugin
+ * Source code: https://github.com/wang-bin/mdk-mft
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+#pragma once
+#include "mdk/global.h"
+#include <cstdint>
+#include <functional>
+
+MDK_NS_BEGIN
+// plane copy and layout conversion kernels, copy and convert in 1 pass. simd implementation is selected at runtime, results are the same as scalar code
+// pitches are in bytes, width is in samples(or sample pairs for interleaved chroma)
+
+// copy rows of bytes
+void copy_plane(const uint8_t* src, int src_pitch, uint8_t* dst, int dst_pitch, int bytes, int rows);
+// copy rows from uncached(write combining) memory, e.g. locked d3d surfaces. sse4.1 streaming loads via a small cached buffer if supported, otherwise copy_plane()
+void copy_plane_uncached(const uint8_t* src, int src_pitch, uint8_t* dst, int dst_pitch, int bytes, int rows);
+// whether copy_plane_uncached() uses streaming loads
+bool has_streaming_load();
+// 16bit samples shifted right, e.g. 6 for p010 luma => yuv420p10le
+void shift_plane16(const uint8_t* src, int src_pitch, uint8_t* dst, int dst_pitch, int width, int rows, int shift);
+// interleaved 8bit uv, e.g. nv12 chroma => yuv420p u and v planes. width: number of uv pairs
+void deinterleave_uv8(const uint8_t* src, int src_pitch, uint8_t* u, int u_pitch, uint8_t* v, int v_pitch, int width, int rows);
+// interleaved 16bit uv, e.g. p010, p016 chroma. samples are shifted right
+void deinterleave_uv16(const uint8_t* src, int src_pitch, uint8_t* u, int u_pitch, uint8_t* v, int v_pitch, int width, int rows, int shift);
+// packed yuy2 => yuv422p. width: number of luma samples, even
+void yuy2_to_planar(const uint8_t* src, int src_pitch, uint8_t* y, int y_pitch, uint8_t* u, int u_pitch, uint8_t* v, int v_pitch, int width, int rows);
+// run f(0), ..., f(bands - 1) concurrently on the calling thread and a small worker pool shared in the process. returns after all bands are done
+void parallel_bands(int bands, const std::function<void(int band)>& f);
+// name of selected implementation, e.g. "sse2", "neon", "c"
+const char* pixel_convert_impl();
+// select "c" or the best simd implementation by name, e.g. to compare results and speed. null or empty: the best. returns false if not supported
+bool select_pixel_convert_impl(const char* name);
+MDK_NS_END
@@ -0,0 +1,41 @@
+/*
+ * Copyright (c) 2022 WangBin <wbsecg1 at gmail.com>
+ * This file is part of MDK MFT plugin
+ * Source code: https://github.com/wang-bin/mdk-mft
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+#include "PlaneLayout.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <iterator>
+
+MDK_NS_BEGIN
+namespace MF {
+PlaneLayout plane_layout(const VideoFormat& fmt, int width, int height, int pitch)
+{
+    PlaneLayout l;
+    l.width = width;
+    l.height = height;
+    const int bpl = fmt.bytesPerLine(width, 0);
+    if (pitch == 0)
+        pitch = bpl;
+    const int abs_pitch = std::abs(pitch);
+    l.planes = std::min<int>(fmt.planeCount(), (int)std::size(l.pitch));
+    size_t offset = 0;
+    for (int plane = 0; plane < l.planes; ++plane) {
+        const int p = plane == 0 || bpl <= 0 ? abs_pitch : int((int64_t)abs_pitch * fmt.bytesPerLine(width, plane) / bpl); // e.g. half for yuv420p chroma, same for nv12
+        l.rows[plane] = fmt.height(height, plane);
+        l.size[plane] = size_t(p) * l.rows[plane];
+        l.pitch[plane] = pitch < 0 ? -p : p;
+        l.offset[plane] = pitch < 0 ? offset + l.size[plane] - p : offset; // top row of a bottom up plane is the last one in memory
+        offset += l.size[plane];
+    }
+    l.total = offset;
+    return l;
+}
+} // namespace MF
+MDK_NS_END
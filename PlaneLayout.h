@@ -0,0 +1,33 @@
+/*
+ * Copyright (c) 2022 WangBin <wbsecg1 at gmail.com>
+ * This file is part of MDK MFT plugin
+ * Source code: https://github.com/wang-bin/mdk-mft
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+#pragma once
+#include "mdk/global.h"
+#include "mdk/VideoFrame.h"
+#include <cstddef>
+
+MDK_NS_BEGIN
+namespace MF {
+// plane layout of an uncompressed buffer, computed once per media type, so only a base pointer is added for each frame
+struct PlaneLayout {
+    int width = 0; // frame size of media type
+    int height = 0;
+    int planes = 0;
+    size_t offset[4]{}; // from buffer start to the top row of each plane
+    size_t size[4]{}; // rows * abs(pitch)
+    int pitch[4]{}; // bytes, < 0: bottom up. chroma pitch and rows are subsampled
+    int rows[4]{};
+    size_t total = 0;
+    PixelFormat format = PixelFormat::Unknown; // of media type, can be different from frame format if converted
+};
+// planes are contiguous in memory, i.e. the layout of media foundation uncompressed video buffers
+// pitch: bytes of the 1st plane row, e.g. MF_MT_DEFAULT_STRIDE. < 0: bottom up, 0: no padding
+PlaneLayout plane_layout(const VideoFormat& fmt, int width, int height, int pitch);
+} // namespace MF
+MDK_NS_END
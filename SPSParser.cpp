@@ -0,0 +1,476 @@
+/*
+ * Copyright (c) 2022 WangBin <wbsecg1 at gmail.com>
+ * This file is part of MDK MFT plugin
+ * Source code: https://github.com/wang-bin/mdk-mft
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+#include "SPSParser.h"
+#include <algorithm>
+#include <vector>
+#if defined(__SSE2__) || defined(_M_X64) || (_M_IX86_FP + 0) >= 2
+# include <emmintrin.h>
+# define NAL_SCAN_SSE2 1
+#elif defined(__aarch64__) || defined(_M_ARM64)
+# include <arm_neon.h>
+# define NAL_SCAN_NEON 1
+#endif
+#if (_MSC_VER + 0)
+# include <intrin.h>
+#endif
+
+MDK_NS_BEGIN
+namespace {
+// rbsp reader. reading beyond the end returns 0 and sets error
+class BitReader
+{
+public:
+    BitReader(const uint8_t* nal, size_t size) {
+        rbsp_.reserve(size);
+        int zeros = 0;
+        for (size_t i = 0; i < size; ++i) { // remove emulation prevention bytes
+            if (zeros >= 2 && nal[i] == 3) {
+                zeros = 0;
+                continue;
+            }
+            zeros = nal[i] ? 0 : zeros + 1;
+            rbsp_.push_back(nal[i]);
+        }
+    }
+    bool error() const { return error_; }
+    uint32_t u(int n) {
+        uint32_t v = 0;
+        for (int i = 0; i < n; ++i) {
+            if (pos_ >= rbsp_.size() * 8) {
+                error_ = true;
+                return 0;
+            }
+            v = (v << 1) | ((rbsp_[pos_ >> 3] >> (7 - (pos_ & 7))) & 1);
+            ++pos_;
+        }
+        return v;
+    }
+    void skip(size_t n) { pos_ += n; }
+    uint32_t ue() {
+        int zeros = 0;
+        while (u(1) == 0 && !error_ && zeros < 32)
+            ++zeros;
+        if (error_ || zeros >= 32) {
+            error_ = true;
+            return 0;
+        }
+        return ((1u << zeros) - 1) + u(zeros);
+    }
+    int32_t se() {
+        const auto v = ue();
+        return (v & 1) ? int32_t((v + 1) / 2) : -int32_t(v / 2);
+    }
+private:
+    std::vector<uint8_t> rbsp_;
+    size_t pos_ = 0;
+    bool error_ = false;
+};
+
+void skip_scaling_list(BitReader& r, int size)
+{
+    int last = 8, next = 8;
+    for (int j = 0; j < size && next != 0; ++j) {
+        next = (last + r.se() + 256) % 256;
+        last = next == 0 ? last : next;
+    }
+}
+
+void skip_h264_hrd(BitReader& r)
+{
+    const auto cpb_cnt = r.ue() + 1;
+    r.skip(4 + 4); // bit_rate_scale, cpb_size_scale
+    for (uint32_t i = 0; i < cpb_cnt && !r.error(); ++i) {
+        r.ue(); // bit_rate_value_minus1
+        r.ue(); // cpb_size_value_minus1
+        r.skip(1); // cbr_flag
+    }
+    r.skip(5 + 5 + 5 + 5);
+}
+} // namespace
+
+bool parse_h264_sps(const uint8_t* nal, size_t size, SPSInfo* info)
+{
+    if (size < 4 || (nal[0] & 0x1f) != 7)
+        return false;
+    BitReader r(nal + 1, size - 1);
+    SPSInfo s;
+    s.profile = r.u(8);
+    const auto constraints = r.u(8);
+    s.level = r.u(8);
+    s.id = r.ue();
+    s.chroma_format = 1;
+    s.bit_depth = 8;
+    switch (s.profile) {
+    case 100: case 110: case 122: case 244: case 44:
+    case 83: case 86: case 118: case 128: case 138: case 139: case 134: case 135:
+        s.chroma_format = r.ue();
+        if (s.chroma_format == 3)
+            r.skip(1); // separate_colour_plane_flag
+        s.bit_depth = r.ue() + 8;
+        r.ue(); // bit_depth_chroma_minus8
+        r.skip(1); // qpprime_y_zero_transform_bypass_flag
+        if (r.u(1)) { // seq_scaling_matrix_present_flag
+            for (int i = 0; i < (s.chroma_format != 3 ? 8 : 12); ++i) {
+                if (r.u(1))
+                    skip_scaling_list(r, i < 6 ? 16 : 64);
+            }
+        }
+        break;
+    default:
+        break;
+    }
+    r.ue(); // log2_max_frame_num_minus4
+    const auto poc_type = r.ue();
+    if (poc_type == 0) {
+        r.ue(); // log2_max_pic_order_cnt_lsb_minus4
+    } else if (poc_type == 1) {
+        r.skip(1); // delta_pic_order_always_zero_flag
+        r.se(); // offset_for_non_ref_pic
+        r.se(); // offset_for_top_to_bottom_field
+        const auto n = r.ue();
+        for (uint32_t i = 0; i < n && !r.error(); ++i)
+            r.se();
+    }
+    const auto max_ref_frames = r.ue();
+    r.skip(1); // gaps_in_frame_num_value_allowed_flag
+    const auto mb_w = r.ue() + 1;
+    const auto map_h = r.ue() + 1;
+    const auto frame_mbs_only = r.u(1);
+    if (!frame_mbs_only)
+        r.skip(1); // mb_adaptive_frame_field_flag
+    r.skip(1); // direct_8x8_inference_flag
+    s.width = mb_w * 16;
+    s.height = map_h * 16 * (2 - frame_mbs_only);
+    if (r.u(1)) { // frame_cropping_flag
+        for (int i = 0; i < 4; ++i)
+            r.ue(); // coded size is used
+    }
+    if (r.u(1)) { // vui_parameters_present_flag
+        if (r.u(1)) { // aspect_ratio_info_present_flag
+            if (r.u(8) == 255) // Extended_SAR
+                r.skip(32);
+        }
+        if (r.u(1)) // overscan_info_present_flag
+            r.skip(1);
+        if (r.u(1)) { // video_signal_type_present_flag
+            r.skip(4);
+            if (r.u(1)) // colour_description_present_flag
+                r.skip(24);
+        }
+        if (r.u(1)) { // chroma_loc_info_present_flag
+            r.ue();
+            r.ue();
+        }
+        if (r.u(1)) // timing_info_present_flag
+            r.skip(32 + 32 + 1);
+        const auto nal_hrd = r.u(1);
+        if (nal_hrd)
+            skip_h264_hrd(r);
+        const auto vcl_hrd = r.u(1);
+        if (vcl_hrd)
+            skip_h264_hrd(r);
+        if (nal_hrd || vcl_hrd)
+            r.skip(1); // low_delay_hrd_flag
+        r.skip(1); // pic_struct_present_flag
+        if (r.u(1)) { // bitstream_restriction_flag
+            r.skip(1); // motion_vectors_over_pic_boundaries_flag
+            r.ue(); // max_bytes_per_pic_denom
+            r.ue(); // max_bits_per_mb_denom
+            r.ue(); // log2_max_mv_length_horizontal
+            r.ue(); // log2_max_mv_length_vertical
+            s.max_reorder = r.ue();
+            s.max_dec_buffering = r.ue();
+        }
+    }
+    if (r.error())
+        return false;
+    if (s.max_reorder < 0) {
+        if (s.profile == 66 || max_ref_frames == 0) { // baseline: no b frames
+            s.max_reorder = 0;
+        } else if ((constraints & 0x10) // constraint_set3_flag: intra profiles
+            && (s.profile == 44 || s.profile == 86 || s.profile == 100 || s.profile == 110 || s.profile == 122 || s.profile == 244)) {
+            s.max_reorder = 0;
+            s.max_dec_buffering = 0;
+        }
+    }
+    *info = s;
+    return true;
+}
+
+bool parse_hevc_sps(const uint8_t* nal, size_t size, SPSInfo* info)
+{
+    if (size < 4 || ((nal[0] >> 1) & 0x3f) != 33)
+        return false;
+    BitReader r(nal + 2, size - 2);
+    SPSInfo s;
+    r.skip(4); // sps_video_parameter_set_id
+    const int max_sub_layers_minus1 = r.u(3);
+    s.max_sub_layers = max_sub_layers_minus1 + 1;
+    r.skip(1); // sps_temporal_id_nesting_flag
+    // profile_tier_level(1, max_sub_layers_minus1)
+    r.skip(2 + 1); // general_profile_space, general_tier_flag
+    s.profile = r.u(5);
+    r.skip(32 + 4 + 43 + 1);
+    s.level = r.u(8);
+    bool sub_profile[8]{}, sub_level[8]{};
+    for (int i = 0; i < max_sub_layers_minus1; ++i) {
+        sub_profile[i] = r.u(1);
+        sub_level[i] = r.u(1);
+    }
+    if (max_sub_layers_minus1 > 0)
+        r.skip(2 * (8 - max_sub_layers_minus1)); // reserved_zero_2bits
+    for (int i = 0; i < max_sub_layers_minus1; ++i) {
+        if (sub_profile[i])
+            r.skip(88);
+        if (sub_level[i])
+            r.skip(8);
+    }
+    s.id = r.ue();
+    s.chroma_format = r.ue();
+    if (s.chroma_format == 3)
+        r.skip(1); // separate_colour_plane_flag
+    s.width = r.ue();
+    s.height = r.ue();
+    if (r.u(1)) { // conformance_window_flag
+        for (int i = 0; i < 4; ++i)
+            r.ue();
+    }
+    s.bit_depth = r.ue() + 8;
+    r.ue(); // bit_depth_chroma_minus8
+    r.ue(); // log2_max_pic_order_cnt_lsb_minus4
+    const auto ordering_info = r.u(1); // sps_sub_layer_ordering_info_present_flag
+    for (int i = ordering_info ? 0 : max_sub_layers_minus1; i <= max_sub_layers_minus1; ++i) {
+        s.max_dec_buffering = r.ue() + 1;
+        s.max_reorder = r.ue();
+        r.ue(); // sps_max_latency_increase_plus1
+    }
+    if (r.error())
+        return false;
+    *info = s;
+    return true;
+}
+
+static inline const uint8_t* start_code_at(const uint8_t* data, const uint8_t* p, int* sc_size)
+{
+    const bool four = p > data && p[-1] == 0;
+    if (sc_size)
+        *sc_size = four ? 4 : 3;
+    return four ? p - 1 : p;
+}
+
+#if (NAL_SCAN_SSE2 + 0)
+static inline int ctz(unsigned v)
+{
+#if (_MSC_VER + 0)
+    unsigned long i = 0;
+    _BitScanForward(&i, v);
+    return (int)i;
+#else
+    return __builtin_ctz(v);
+#endif
+}
+#endif
+
+const uint8_t* find_start_code(const uint8_t* data, const uint8_t* end, int* sc_size)
+{
+    auto p = data;
+    // 16 positions per iteration: zero byte pairs, then check the 3rd byte of each candidate
+#if (NAL_SCAN_SSE2 + 0)
+    const auto zero = _mm_setzero_si128();
+    for (; p + 18 <= end; p += 16) {
+        const auto z0 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)p), zero);
+        const auto z1 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(p + 1)), zero);
+        for (auto mask = (unsigned)_mm_movemask_epi8(_mm_and_si128(z0, z1)); mask; mask &= mask - 1) {
+            const auto q = p + ctz(mask);
+            if (q[2] == 1)
+                return start_code_at(data, q, sc_size);
+        }
+    }
+#elif (NAL_SCAN_NEON + 0)
+    for (; p + 18 <= end; p += 16) {
+        const auto z = vandq_u8(vceqzq_u8(vld1q_u8(p)), vceqzq_u8(vld1q_u8(p + 1)));
+        if (vmaxvq_u8(z) == 0)
+            continue;
+        for (auto q = p; q < p + 16; ++q) {
+            if (q[0] == 0 && q[1] == 0 && q[2] == 1)
+                return start_code_at(data, q, sc_size);
+        }
+    }
+#endif
+    for (; p + 3 <= end; ++p) {
+        if (p[2] > 1) { // fast skip
+            p += 2;
+            continue;
+        }
+        if (p[0] == 0 && p[1] == 0 && p[2] == 1)
+            return start_code_at(data, p, sc_size);
+    }
+    return end;
+}
+
+bool is_annexb_data(const uint8_t* data, size_t size)
+{
+    const auto end = data + size;
+    const auto p = find_start_code(data, end);
+    return p < end && std::all_of(data, p, [](uint8_t b) { return b == 0; });
+}
+
+bool parameter_set_id(const uint8_t* nal, size_t size, bool hevc, int* type, int* id)
+{
+    if (size < 3)
+        return false;
+    if (hevc) {
+        *type = (nal[0] >> 1) & 0x3f;
+        if (*type < 32 || *type > 34)
+            return false;
+        if (*type == 32) { // vps
+            *id = nal[2] >> 4;
+            return true;
+        }
+        BitReader r(nal + 2, size - 2);
+        if (*type == 33) {
+            SPSInfo s;
+            if (!parse_hevc_sps(nal, size, &s))
+                return false;
+            *id = s.id;
+            return true;
+        }
+        *id = r.ue();
+        return !r.error();
+    }
+    *type = nal[0] & 0x1f;
+    if (*type != 7 && *type != 8)
+        return false;
+    BitReader r(nal + 1, size - 1);
+    if (*type == 7)
+        r.skip(24); // profile, constraints, level
+    *id = r.ue();
+    return !r.error();
+}
+
+bool is_disposable(const uint8_t* data, size_t size, int nal_size, bool hevc, bool nonref, int max_tid, int sub_layers)
+{
+    // a sub-layer non-reference picture can be referenced by pictures in higher sub-layers
+    int highest = sub_layers > 0 ? sub_layers - 1 : -1;
+    if (max_tid >= 0 && (highest < 0 || max_tid < highest))
+        highest = max_tid;
+    int slices = 0;
+    bool disposable = true;
+    for_each_nal(data, size, nal_size, [&](const uint8_t* nal, size_t len) {
+        if (hevc) {
+            if (len < 2)
+                return true;
+            const int type = (nal[0] >> 1) & 0x3f;
+            if (type > 31) // non-vcl
+                return true;
+            slices++;
+            const int tid = (nal[1] & 7) - 1;
+            if (max_tid >= 0 && tid > max_tid)
+                return true;
+            disposable = nonref && highest >= 0 && tid >= highest && type <= 14 && (type & 1) == 0; // TRAIL_N, TSA_N, STSA_N, RADL_N, RASL_N, RSV_VCL_N10/12/14
+        } else {
+            const int type = nal[0] & 0x1f;
+            if (type != 1 && type != 5)
+                return true;
+            slices++;
+            disposable = nonref && (nal[0] & 0x60) == 0; // nal_ref_idc
+        }
+        return disposable;
+    });
+    return slices > 0 && disposable;
+}
+
+bool parse_sps_annexb(const uint8_t* data, size_t size, bool hevc, SPSInfo* info)
+{
+    const auto end = data + size;
+    int sc = 0;
+    auto p = find_start_code(data, end, &sc);
+    while (p < end) {
+        const auto nal = p + sc;
+        const auto next = find_start_code(nal, end, &sc);
+        auto nal_end = next;
+        while (nal_end > nal && nal_end[-1] == 0) // trailing_zero_8bits
+            --nal_end;
+        if (nal < nal_end) {
+            if (hevc ? parse_hevc_sps(nal, nal_end - nal, info) : parse_h264_sps(nal, nal_end - nal, info))
+                return true;
+        }
+        p = next;
+    }
+    return false;
+}
+bool parse_hvcc(const uint8_t* data, size_t size, SPSInfo* info)
+{
+    if (size < 23 || data[0] != 1)
+        return false;
+    SPSInfo s;
+    s.profile = data[1] & 0x1f;
+    s.level = data[12];
+    s.chroma_format = data[16] & 0x3;
+    s.bit_depth = (data[17] & 0x7) + 8;
+    auto p = data + 23;
+    const auto end = data + size;
+    for (int i = 0; i < data[22] && p + 3 <= end; ++i) {
+        const int type = p[0] & 0x3f;
+        const int count = (p[1] << 8) | p[2];
+        p += 3;
+        for (int j = 0; j < count && p + 2 <= end; ++j) {
+            const size_t len = (p[0] << 8) | p[1];
+            p += 2;
+            if (len > size_t(end - p))
+                break;
+            SPSInfo sps;
+            if (type == 33 && s.width < 0 && parse_hevc_sps(p, len, &sps)) {
+                s.id = sps.id;
+                s.width = sps.width;
+                s.height = sps.height;
+                s.max_reorder = sps.max_reorder;
+                s.max_dec_buffering = sps.max_dec_buffering;
+                s.max_sub_layers = sps.max_sub_layers;
+            }
+            p += len;
+        }
+    }
+    *info = s;
+    return true;
+}
+
+bool parse_vpcc(const uint8_t* data, size_t size, SPSInfo* info)
+{
+    if (size < 8 || data[0] != 1) // version 1 full box w/o box header
+        return false;
+    SPSInfo s;
+    s.profile = data[4];
+    s.level = data[5];
+    s.bit_depth = data[6] >> 4;
+    const int subsampling = (data[6] >> 1) & 0x7; // 0, 1: 420, 2: 422, 3: 444
+    s.chroma_format = subsampling < 2 ? 1 : subsampling;
+    *info = s;
+    return true;
+}
+
+bool parse_av1c(const uint8_t* data, size_t size, SPSInfo* info)
+{
+    if (size < 4 || data[0] != 0x81) // marker, version 1
+        return false;
+    SPSInfo s;
+    s.profile = data[1] >> 5;
+    s.level = data[1] & 0x1f;
+    const bool high_bitdepth = data[2] & 0x40;
+    const bool twelve_bit = data[2] & 0x20;
+    s.bit_depth = twelve_bit ? 12 : (high_bitdepth ? 10 : 8);
+    const bool mono = data[2] & 0x10;
+    const bool ss_x = data[2] & 0x08;
+    const bool ss_y = data[2] & 0x04;
+    s.chroma_format = mono ? 0 : (ss_x ? (ss_y ? 1 : 2) : 3);
+    *info = s;
+    return true;
+}
+MDK_NS_END
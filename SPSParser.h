@@ -0,0 +1,78 @@
+/*
+ * Copyright (c) 2022 WangBin <wbsecg1 at gmail.com>
+ * This file is part of MDK MFT plugin
+ * Source code: https://github.com/wang-bin/mdk-mft
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+#pragma once
+#include "mdk/global.h"
+#include <cstddef>
+#include <cstdint>
+
+MDK_NS_BEGIN
+// fields used by decoder, -1 if not present in bitstream
+struct SPSInfo {
+    int id = -1;
+    int profile = -1;
+    int level = -1;
+    int chroma_format = -1; // 0: 400, 1: 420, 2: 422, 3: 444
+    int bit_depth = -1; // luma
+    int width = -1; // coded size
+    int height = -1;
+    int max_reorder = -1; // h264 vui max_num_reorder_frames, hevc sps_max_num_reorder_pics of the highest sub-layer
+    int max_dec_buffering = -1; // h264 vui max_dec_frame_buffering, hevc sps_max_dec_pic_buffering_minus1 + 1
+    int max_sub_layers = -1; // hevc sps_max_sub_layers_minus1 + 1
+};
+
+// nal: a nal unit with header, without start code
+bool parse_h264_sps(const uint8_t* nal, size_t size, SPSInfo* info);
+bool parse_hevc_sps(const uint8_t* nal, size_t size, SPSInfo* info);
+// parse the 1st sps in annexb data
+bool parse_sps_annexb(const uint8_t* data, size_t size, bool hevc, SPSInfo* info);
+// codec configuration records in extradata: hvcC(and the 1st sps in it), vpcC v1 w/o box header, av1C. fields not in a record are -1
+bool parse_hvcc(const uint8_t* data, size_t size, SPSInfo* info);
+bool parse_vpcc(const uint8_t* data, size_t size, SPSInfo* info);
+bool parse_av1c(const uint8_t* data, size_t size, SPSInfo* info);
+// parameter set nal(h264 sps/pps, hevc vps/sps/pps) type and id. returns false if not a parameter set
+bool parameter_set_id(const uint8_t* nal, size_t size, bool hevc, int* type, int* id);
+// a picture can be dropped before decoding if all slices are:
+// - nonref: h264 nal_ref_idc == 0, or hevc sub-layer non-reference in the highest sub-layer decoded, i.e. temporal id == max_tid, or sub_layers - 1 if max_tid < 0
+// - or hevc temporal id > max_tid(if >= 0)
+// nal_size: length prefix size, 0 for annexb. sub_layers: hevc SPSInfo.max_sub_layers, non-reference pictures are kept if unknown
+bool is_disposable(const uint8_t* data, size_t size, int nal_size, bool hevc, bool nonref, int max_tid = -1, int sub_layers = -1);
+// returns start code position(>= data) and size(3 or 4) in *sc_size, or data + size if not found
+const uint8_t* find_start_code(const uint8_t* data, const uint8_t* end, int* sc_size = nullptr);
+// annexb data starts with a start code after optional zero bytes, while avcC and hvcC start with configurationVersion 1
+bool is_annexb_data(const uint8_t* data, size_t size);
+
+// calls f(nal, size) for each nal, stops if f returns false
+template<typename F>
+void for_each_nal(const uint8_t* data, size_t size, int nal_size, F&& f)
+{
+    const auto end = data + size;
+    if (nal_size > 0) {
+        for (auto p = data; p + nal_size <= end;) {
+            size_t len = 0;
+            for (int i = 0; i < nal_size; ++i)
+                len = (len << 8) | p[i];
+            p += nal_size;
+            if (len > size_t(end - p))
+                return;
+            if (!f(p, len))
+                return;
+            p += len;
+        }
+        return;
+    }
+    int sc = 0;
+    for (auto p = find_start_code(data, end, &sc); p < end;) {
+        const auto nal = p + sc;
+        p = find_start_code(nal, end, &sc);
+        if (nal < p && !f(nal, size_t(p - nal)))
+            return;
+    }
+}
+MDK_NS_END
@@ -0,0 +1,34 @@
+/*
+ * Copyright (c) 2022 WangBin <wbsecg1 at gmail.com>
+ * This file is part of MDK MFT plugin
+ * Source code: https://github.com/wang-bin/mdk-mft
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+// failed checks are printed and counted. main() returns test_failures() != 0
+#pragma once
+#include <cstdio>
+
+inline int& test_failures()
+{
+    static int n = 0;
+    return n;
+}
+
+#define CHECK(cond) do { \
+        if (!(cond)) { \
+            std::fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+            ++test_failures(); \
+        } \
+    } while (false)
+
+#define CHECK_EQ(a, b) do { \
+        const auto a_ = (a); \
+        const auto b_ = (b); \
+        if (!(a_ == b_)) { \
+            std::fprintf(stderr, "%s:%d: CHECK_EQ(%s, %s) failed: %lld != %lld\n", __FILE__, __LINE__, #a, #b, (long long)a_, (long long)b_); \
+            ++test_failures(); \
+        } \
+    } while (false)
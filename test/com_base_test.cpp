@@ -0,0 +1,138 @@
+/*
+ * Copyright (c) 2022 WangBin <wbsecg1 at gmail.com>
+ * This file is part of MDK MFT plugin
+ * Source code: https://github.com/wang-bin/mdk-mft
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+// ComBase reference counting and QueryInterface, built with compat/unknwn.h
+#include "ComBase.h"
+#include "check.h"
+#include <thread>
+#include <vector>
+
+using Microsoft::WRL::ComPtr;
+
+struct IFoo : IUnknown {
+    virtual int foo() = 0;
+};
+struct IBar : IUnknown {
+    virtual int bar() = 0;
+};
+struct IBaz : IUnknown {};
+
+template<> const GUID& uuid_of<IFoo>()
+{
+    static const GUID id{1, 0, 0, {}};
+    return id;
+}
+template<> const GUID& uuid_of<IBar>()
+{
+    static const GUID id{2, 0, 0, {}};
+    return id;
+}
+template<> const GUID& uuid_of<IBaz>()
+{
+    static const GUID id{3, 0, 0, {}};
+    return id;
+}
+
+class FooBar final : public ComBase<IFoo, IBar>
+{
+public:
+    FooBar(bool* deleted) : deleted_(deleted) {}
+    ~FooBar() override { *deleted_ = true; }
+    int foo() override { return 1; }
+    int bar() override { return 2; }
+private:
+    bool* deleted_;
+};
+
+static void test_ref()
+{
+    bool deleted = false;
+    auto p = make_com<FooBar>(&deleted);
+    CHECK_EQ(p->AddRef(), 2u); // 1 ref from make_com
+    CHECK_EQ(p->Release(), 1u);
+    {
+        auto p2 = p;
+        CHECK_EQ(p->AddRef(), 3u);
+        CHECK_EQ(p->Release(), 2u);
+    }
+    CHECK(!deleted);
+    p.Reset();
+    CHECK(deleted);
+}
+
+static void test_query()
+{
+    bool deleted = false;
+    auto p = make_com<FooBar>(&deleted);
+    void* unk = nullptr;
+    CHECK_EQ(p->QueryInterface(__uuidof(IUnknown), &unk), S_OK);
+    CHECK(unk == static_cast<IUnknown*>(static_cast<IFoo*>(p.Get()))); // identity is the 1st interface
+    void* foo = nullptr;
+    CHECK_EQ(p->QueryInterface(__uuidof(IFoo), &foo), S_OK);
+    CHECK(foo == static_cast<IFoo*>(p.Get()));
+    CHECK_EQ(static_cast<IFoo*>(foo)->foo(), 1);
+    void* bar = nullptr;
+    CHECK_EQ(p->QueryInterface(__uuidof(IBar), &bar), S_OK);
+    CHECK(bar == static_cast<IBar*>(p.Get()));
+    CHECK(bar != foo);
+    CHECK_EQ(static_cast<IBar*>(bar)->bar(), 2);
+    // the same count for all interfaces
+    CHECK_EQ(static_cast<IBar*>(bar)->AddRef(), 5u);
+    CHECK_EQ(static_cast<IFoo*>(foo)->Release(), 4u);
+    void* baz = &deleted;
+    CHECK_EQ(p->QueryInterface(__uuidof(IBaz), &baz), E_NOINTERFACE);
+    CHECK(baz == nullptr);
+    CHECK_EQ(p->QueryInterface(__uuidof(IFoo), nullptr), E_POINTER);
+    // query from the 2nd interface
+    void* foo2 = nullptr;
+    CHECK_EQ(static_cast<IBar*>(bar)->QueryInterface(__uuidof(IFoo), &foo2), S_OK);
+    CHECK(foo2 == foo);
+    CHECK_EQ(p->AddRef(), 6u);
+    p->Release();
+    static_cast<IFoo*>(foo2)->Release();
+    static_cast<IUnknown*>(unk)->Release();
+    static_cast<IFoo*>(foo)->Release();
+    p.Reset();
+    CHECK(!deleted);
+    static_cast<IBar*>(bar)->Release(); // last ref from the 2nd interface deletes
+    CHECK(deleted);
+}
+
+static void test_threads()
+{
+    bool deleted = false;
+    auto p = make_com<FooBar>(&deleted);
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 4; ++i) {
+        threads.emplace_back([p]{
+            for (int n = 0; n < 100000; ++n) {
+                auto q = p;
+                p->AddRef();
+                p->Release();
+            }
+        });
+    }
+    for (auto& t : threads)
+        t.join();
+    CHECK(!deleted);
+    CHECK_EQ(p->AddRef(), 2u);
+    p->Release();
+    p.Reset();
+    CHECK(deleted);
+}
+
+int main()
+{
+    test_ref();
+    test_query();
+    test_threads();
+    if (test_failures() == 0)
+        printf("com base: all passed\n");
+    return test_failures() != 0;
+}
@@ -0,0 +1,34 @@
+/*
+ * Copyright (c) 2022 WangBin <wbsecg1 at gmail.com>
+ * This file is part of MDK MFT plugin
+ * Source code: https://github.com/wang-bin/mdk-mft
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+// mdk ByteArrayBuffer2D: rows of bytes owned by the buffer
+#pragma once
+#include "mdk/VideoFrame.h"
+#include <cstring>
+#include <memory>
+
+MDK_NS_BEGIN
+class ByteArrayBuffer2D final : public Buffer2D
+{
+public:
+    // data: copied if not null, otherwise uninitialized
+    ByteArrayBuffer2D(size_t stride, size_t rows, const uint8_t* data) : data_(new uint8_t[stride * rows]), size_(stride * rows), stride_(stride) {
+        if (data)
+            memcpy(data_.get(), data, size_);
+    }
+    uint8_t* data() { return data_.get(); }
+    const Byte* constData() const override { return data_.get(); }
+    size_t size() const override { return size_; }
+    size_t stride() const override { return stride_; }
+private:
+    std::unique_ptr<uint8_t[]> data_;
+    size_t size_;
+    size_t stride_;
+};
+MDK_NS_END
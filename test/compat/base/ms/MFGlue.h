@@ -0,0 +1,101 @@
+/*
+ * Copyright (c) 2022 WangBin <wbsecg1 at gmail.com>
+ * This file is part of MDK MFT plugin
+ * Source code: https://github.com/wang-bin/mdk-mft
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+// media foundation buffer and sample interfaces, and the MFGlue.h declarations used by MFVideoBuffer.cpp, so it builds without windows sdk
+// methods not called by the plugin are omitted, so implementations in tests are not real COM objects
+#pragma once
+#include "mdk/global.h"
+#include "ComBase.h"
+#include "PlaneLayout.h"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+typedef uint8_t BYTE;
+typedef int32_t LONG;
+typedef uint32_t UINT;
+typedef uint32_t DWORD;
+typedef int64_t LONGLONG;
+#define SUCCEEDED(hr) (((HRESULT)(hr)) >= 0)
+#define FAILED(hr) (((HRESULT)(hr)) < 0)
+#define E_FAIL ((HRESULT)0x80004005)
+#define MS_CHECK(f, ...) do { \
+        if (FAILED(f)) { \
+            __VA_ARGS__ \
+        } \
+    } while (false)
+#define MS_ENSURE(f, ...) MS_CHECK(f, return __VA_ARGS__;)
+#define MS_WARN(f) MS_CHECK(f)
+
+using namespace Microsoft::WRL;
+
+template<class T> const GUID& iid_of(ComPtrRef<T>) { return uuid_of<T>(); }
+template<class T> void** ppv_of(ComPtrRef<T> p) { return (void**)static_cast<T**>(p); }
+#define IID_PPV_ARGS(pp) iid_of(pp), ppv_of(pp)
+
+enum MF2DBuffer_LockFlags {
+    MF2DBuffer_LockFlags_Read = 1,
+};
+
+struct IMFMediaBuffer : IUnknown {
+    virtual HRESULT STDMETHODCALLTYPE Lock(BYTE** data, DWORD* max_len, DWORD* len) = 0;
+    virtual HRESULT STDMETHODCALLTYPE Unlock() = 0;
+    virtual HRESULT STDMETHODCALLTYPE GetCurrentLength(DWORD* len) = 0;
+};
+
+struct IMF2DBuffer : IUnknown {
+    virtual HRESULT STDMETHODCALLTYPE Lock2D(BYTE** scanline0, LONG* pitch) = 0;
+    virtual HRESULT STDMETHODCALLTYPE Unlock2D() = 0;
+};
+
+struct IMF2DBuffer2 : IMF2DBuffer {
+    virtual HRESULT STDMETHODCALLTYPE Lock2DSize(MF2DBuffer_LockFlags flags, BYTE** scanline0, LONG* pitch, BYTE** start, DWORD* len) = 0;
+};
+
+struct IMFDXGIBuffer : IUnknown {
+    virtual HRESULT STDMETHODCALLTYPE GetResource(REFIID riid, void** ppv) = 0;
+    virtual HRESULT STDMETHODCALLTYPE GetSubresourceIndex(UINT* index) = 0;
+};
+
+struct IMFSample : IUnknown {
+    virtual HRESULT STDMETHODCALLTYPE GetSampleTime(LONGLONG* t) = 0;
+    virtual HRESULT STDMETHODCALLTYPE GetBufferCount(DWORD* count) = 0;
+    virtual HRESULT STDMETHODCALLTYPE GetBufferByIndex(DWORD index, IMFMediaBuffer** buf) = 0;
+};
+
+#define MF_COMPAT_UUID(T, l, w1, w2, b1, b2, b3, b4, b5, b6, b7, b8) \
+    template<> inline const GUID& uuid_of<T>() { \
+        static const GUID id{l, w1, w2, {b1, b2, b3, b4, b5, b6, b7, b8}}; \
+        return id; \
+    }
+MF_COMPAT_UUID(IMFMediaBuffer, 0x045fa593, 0x8799, 0x42b8, 0xbc, 0x8d, 0x89, 0x68, 0xc6, 0x45, 0x35, 0x07)
+MF_COMPAT_UUID(IMF2DBuffer, 0x7dc9d5f9, 0x9ed9, 0x44ec, 0x9b, 0xbf, 0x06, 0x00, 0xbb, 0x58, 0x9f, 0xbb)
+MF_COMPAT_UUID(IMF2DBuffer2, 0x33ae5ea6, 0x4316, 0x436f, 0x8d, 0xdd, 0xd7, 0x3d, 0x22, 0xf8, 0x29, 0xec)
+MF_COMPAT_UUID(IMFDXGIBuffer, 0xe7174cfa, 0x1c9e, 0x48b1, 0x88, 0x66, 0x62, 0x62, 0x26, 0xbf, 0xc2, 0x58)
+MF_COMPAT_UUID(IMFSample, 0xc40a00f2, 0xb93a, 0x4d80, 0xae, 0x8c, 0x5a, 0x1c, 0x63, 0x4f, 0x58, 0xe4)
+#undef MF_COMPAT_UUID
+
+MDK_NS_BEGIN
+class Buffer2D;
+class VideoFormat;
+class VideoFrame;
+
+namespace MF {
+std::shared_ptr<Buffer2D> to(ComPtr<IMF2DBuffer> b, ptrdiff_t offset = 0, int size = -1);
+
+static inline double from_mf_time(LONGLONG ns_100)
+{
+    return ns_100/100000000.0;
+}
+
+uint64_t buffer_locks();
+bool can_convert(const VideoFormat& from, const VideoFormat& to);
+bool to(VideoFrame& frame, ComPtr<IMFSample> sample, const PlaneLayout& layout, int copy = 0, int threads = 1);
+} // namespace MF
+MDK_NS_END
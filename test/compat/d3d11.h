@@ -0,0 +1,20 @@
+/*
+ * Copyright (c) 2022 WangBin <wbsecg1 at gmail.com>
+ * This file is part of MDK MFT plugin
+ * Source code: https://github.com/wang-bin/mdk-mft
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+// d3d11 types used by MFVideoBuffer.cpp, so it builds without windows sdk
+#pragma once
+#include <unknwn.h>
+
+struct ID3D11Texture2D : IUnknown {};
+
+template<> inline const GUID& uuid_of<ID3D11Texture2D>()
+{
+    static const GUID id{0x6f15aaf2, 0xd208, 0x4e89, {0x9a, 0xb4, 0x48, 0x95, 0x35, 0xd3, 0x4f, 0x9c}};
+    return id;
+}
@@ -0,0 +1,146 @@
+/*
+ * Copyright (c) 2022 WangBin <wbsecg1 at gmail.com>
+ * This file is part of MDK MFT plugin
+ * Source code: https://github.com/wang-bin/mdk-mft
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+// VideoFormat of the formats output by media foundation decoders and converted to, and the VideoFrame/buffer api used by the plugin. names are mdk's, values are not
+// frame planes are stored without heap allocation, so allocation counting measures the plugin code only
+#pragma once
+#include "mdk/global.h"
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
+
+MDK_NS_BEGIN
+enum class PixelFormat {
+    Unknown = -1,
+    YUV420P,
+    NV12,
+    YUYV422,
+    UYVY422,
+    P010LE,
+    P016LE,
+    YUV420P10LE,
+    YUV422P,
+};
+
+class VideoFormat
+{
+public:
+    VideoFormat(PixelFormat fmt = PixelFormat::Unknown) : fmt_(fmt) {}
+    PixelFormat format() const { return fmt_; }
+    int planeCount() const {
+        switch (fmt_) {
+        case PixelFormat::YUV420P:
+        case PixelFormat::YUV420P10LE:
+        case PixelFormat::YUV422P: return 3;
+        case PixelFormat::NV12:
+        case PixelFormat::P010LE:
+        case PixelFormat::P016LE: return 2;
+        case PixelFormat::YUYV422:
+        case PixelFormat::UYVY422: return 1;
+        default: return 0;
+        }
+    }
+    // chroma width and height are rounded up
+    int bytesPerLine(int width, int plane) const {
+        const int cw = (width + 1) / 2;
+        switch (fmt_) {
+        case PixelFormat::YUV420P:
+        case PixelFormat::YUV422P: return plane == 0 ? width : cw;
+        case PixelFormat::YUV420P10LE: return plane == 0 ? width * 2 : cw * 2;
+        case PixelFormat::NV12: return plane == 0 ? width : cw * 2;
+        case PixelFormat::P010LE:
+        case PixelFormat::P016LE: return plane == 0 ? width * 2 : cw * 4;
+        case PixelFormat::YUYV422:
+        case PixelFormat::UYVY422: return cw * 4;
+        default: return 0;
+        }
+    }
+    int height(int h, int plane) const {
+        return plane > 0 && planeCount() > 1 && fmt_ != PixelFormat::YUV422P ? (h + 1) / 2 : h;
+    }
+    bool operator==(const VideoFormat& other) const { return fmt_ == other.fmt_; }
+private:
+    PixelFormat fmt_;
+};
+
+using Byte = uint8_t;
+
+class Buffer2D
+{
+public:
+    virtual ~Buffer2D() = default;
+    virtual const Byte* constData() const = 0;
+    virtual size_t size() const = 0;
+    virtual size_t stride() const = 0;
+};
+
+class NativeVideoBuffer
+{
+public:
+    enum Type { Original };
+    struct MapParameter {};
+    virtual ~NativeVideoBuffer() = default;
+    virtual void* map(Type type, MapParameter* param) = 0;
+};
+using NativeVideoBufferRef = std::shared_ptr<NativeVideoBuffer>;
+
+class NativeVideoBufferPool
+{
+public:
+    virtual ~NativeVideoBufferPool() = default;
+    virtual NativeVideoBufferRef getBuffer(void* opaque, std::function<void()> cb) = 0;
+};
+using NativeVideoBufferPoolRef = std::shared_ptr<NativeVideoBufferPool>;
+
+class VideoFrame
+{
+public:
+    VideoFrame() = default;
+    VideoFrame(int width, int height, const VideoFormat& format) : w_(width), h_(height), fmt_(format) {}
+    int width() const { return w_; }
+    int height() const { return h_; }
+    const VideoFormat& format() const { return fmt_; }
+    double timestamp() const { return t_; }
+    void setTimestamp(double t) { t_ = t; }
+    // plane < 0: the next plane
+    void addBuffer(std::shared_ptr<Buffer2D> b, int plane = -1) { planes_[plane < 0 ? nb_planes_ : plane] = b; nb_planes_++; }
+    std::shared_ptr<Buffer2D> buffer(int plane = 0) const { return planes_[plane]; }
+    int bufferCount() const { return nb_planes_; }
+    // copy planes of the frame size and format
+    void setBuffers(const uint8_t* const* data, const int* strides);
+    void setNativeBuffer(NativeVideoBufferRef b) { native_ = b; }
+    NativeVideoBufferRef nativeBuffer() const { return native_; }
+private:
+    int w_ = 0;
+    int h_ = 0;
+    VideoFormat fmt_;
+    double t_ = 0;
+    std::shared_ptr<Buffer2D> planes_[4];
+    int nb_planes_ = 0;
+    NativeVideoBufferRef native_;
+};
+MDK_NS_END
+
+#include "base/ByteArrayBuffer.h"
+
+MDK_NS_BEGIN
+inline void VideoFrame::setBuffers(const uint8_t* const* data, const int* strides)
+{
+    for (int plane = 0; plane < fmt_.planeCount(); ++plane) {
+        const int bytes = fmt_.bytesPerLine(w_, plane);
+        const int rows = fmt_.height(h_, plane);
+        auto b = std::make_shared<ByteArrayBuffer2D>(bytes, rows, nullptr);
+        for (int y = 0; y < rows; ++y)
+            memcpy(b->data() + (size_t)y * bytes, data[plane] + (ptrdiff_t)y * strides[plane], bytes);
+        addBuffer(b);
+    }
+}
+MDK_NS_END
@@ -0,0 +1,14 @@
+/*
+ * Copyright (c) 2022 WangBin <wbsecg1 at gmail.com>
+ * This file is part of MDK MFT plugin
+ * Source code: https://github.com/wang-bin/mdk-mft
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+// minimal mdk declarations used by tested sources, so tests build without mdk
+#pragma once
+#define MDK_NS mdk
+#define MDK_NS_BEGIN namespace MDK_NS {
+#define MDK_NS_END }
@@ -0,0 +1,45 @@
+/*
+ * Copyright (c) 2022 WangBin <wbsecg1 at gmail.com>
+ * This file is part of MDK MFT plugin
+ * Source code: https://github.com/wang-bin/mdk-mft
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+// minimal IUnknown declarations used by ComBase.h, so it builds without windows sdk
+// __uuidof(T) is uuid_of<T>(), specialized for each interface
+#pragma once
+#include <cstdint>
+#include <cstring>
+
+typedef int32_t HRESULT;
+typedef uint32_t ULONG;
+#define STDMETHODCALLTYPE
+#define S_OK ((HRESULT)0)
+#define E_NOINTERFACE ((HRESULT)0x80004002)
+#define E_POINTER ((HRESULT)0x80004003)
+
+struct GUID {
+    uint32_t Data1;
+    uint16_t Data2;
+    uint16_t Data3;
+    uint8_t Data4[8];
+};
+typedef const GUID& REFIID;
+inline bool operator==(const GUID& a, const GUID& b) { return memcmp(&a, &b, sizeof(a)) == 0; }
+
+template<class T> const GUID& uuid_of();
+#define __uuidof(T) uuid_of<T>()
+
+struct IUnknown {
+    virtual HRESULT STDMETHODCALLTYPE QueryInterface(REFIID riid, void** ppv) = 0;
+    virtual ULONG STDMETHODCALLTYPE AddRef() = 0;
+    virtual ULONG STDMETHODCALLTYPE Release() = 0;
+};
+
+template<> inline const GUID& uuid_of<IUnknown>()
+{
+    static const GUID id{0, 0, 0, {0xc0, 0, 0, 0, 0, 0, 0, 0x46}};
+    return id;
+}
@@ -0,0 +1,68 @@
+/*
+ * Copyright (c) 2022 WangBin <wbsecg1 at gmail.com>
+ * This file is part of MDK MFT plugin
+ * Source code: https://github.com/wang-bin/mdk-mft
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+// minimal ComPtr used by make_com() and MFVideoBuffer.cpp, so they build without windows sdk
+#pragma once
+#include <unknwn.h>
+#include <utility>
+
+namespace Microsoft {
+namespace WRL {
+template<class T> class ComPtr;
+
+// result of &ComPtr: T** for out parameters(the old pointer is released), or ComPtr*
+template<class T>
+class ComPtrRef
+{
+public:
+    ComPtrRef(ComPtr<T>* p) : p_(p) {}
+    operator T**() const { return p_->ReleaseAndGetAddressOf(); }
+    operator ComPtr<T>*() const { return p_; }
+private:
+    ComPtr<T>* p_;
+};
+
+template<class T>
+class ComPtr
+{
+public:
+    ComPtr() = default;
+    ComPtr(T* p) : p_(p) {
+        if (p_)
+            p_->AddRef();
+    }
+    ComPtr(const ComPtr& other) : ComPtr(other.p_) {}
+    template<class U>
+    ComPtr(const ComPtr<U>& other) : ComPtr(other.Get()) {}
+    ComPtr& operator=(ComPtr other) {
+        std::swap(p_, other.p_);
+        return *this;
+    }
+    ~ComPtr() { Reset(); }
+
+    T* Get() const { return p_; }
+    T* operator->() const { return p_; }
+    explicit operator bool() const { return !!p_; }
+    ComPtrRef<T> operator&() { return ComPtrRef<T>(this); }
+    T** ReleaseAndGetAddressOf() {
+        Reset();
+        return &p_;
+    }
+    void Reset() {
+        if (p_)
+            p_->Release();
+        p_ = nullptr;
+    }
+    template<class U>
+    HRESULT As(ComPtrRef<U> p) const { return p_->QueryInterface(__uuidof(U), (void**)static_cast<U**>(p)); }
+private:
+    T* p_ = nullptr;
+};
+} // namespace WRL
+} // namespace Microsoft
@@ -0,0 +1,170 @@
+/*
+ * Copyright (c) 2022 WangBin <wbsecg1 at gmail.com>
+ * This file is part of MDK MFT plugin
+ * Source code: https://github.com/wang-bin/mdk-mft
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+// find_start_code() and for_each_nal() are the same as a byte by byte scanner for any start and end position
+// --bench: time of scanning 64MB random data
+#include "SPSParser.h"
+#include "check.h"
+#include <chrono>
+#include <cstring>
+#include <random>
+#include <utility>
+#include <vector>
+
+using namespace MDK_NS;
+using namespace std;
+
+static mt19937 rng(1);
+
+static const uint8_t* find_start_code_scalar(const uint8_t* data, const uint8_t* end, int* sc_size)
+{
+    for (auto p = data; p + 3 <= end; ++p) {
+        if (p[0] == 0 && p[1] == 0 && p[2] == 1) {
+            const bool four = p > data && p[-1] == 0;
+            *sc_size = four ? 4 : 3;
+            return four ? p - 1 : p;
+        }
+    }
+    return end;
+}
+
+using NALs = vector<pair<const uint8_t*, size_t>>;
+
+static NALs nals_scalar(const uint8_t* data, size_t size)
+{
+    NALs v;
+    const auto end = data + size;
+    int sc = 0;
+    for (auto p = find_start_code_scalar(data, end, &sc); p < end;) {
+        const auto nal = p + sc;
+        p = find_start_code_scalar(nal, end, &sc);
+        if (nal < p)
+            v.emplace_back(nal, size_t(p - nal));
+    }
+    return v;
+}
+
+// mostly 0 and 1 bytes, so start codes, 4 byte start codes and near misses(00 00 00 00, 00 00 02) are dense
+static vector<uint8_t> random_stream(size_t size, int zero_percent)
+{
+    vector<uint8_t> v(size);
+    for (auto& x : v) {
+        const auto r = int(rng() % 100);
+        x = r < zero_percent ? 0 : r < zero_percent + 15 ? 1 : r < zero_percent + 20 ? 2 : uint8_t(rng());
+    }
+    return v;
+}
+
+static void check_stream(const vector<uint8_t>& buf)
+{
+    // every start offset, end at buffer end or in the middle, so simd blocks and scalar tails start anywhere
+    const auto data = buf.data();
+    for (size_t e : {buf.size(), buf.size() / 2 + 1}) {
+        if (e > buf.size())
+            continue;
+        const auto end = data + e;
+        for (auto p = data; p <= end; ++p) {
+            int sc = 0, sc_ref = 0;
+            const auto q = find_start_code(p, end, &sc);
+            const auto q_ref = find_start_code_scalar(p, end, &sc_ref);
+            if (q != q_ref || (q < end && sc != sc_ref)) {
+                fprintf(stderr, "find_start_code size %d offset %d: %d(%d), expect %d(%d)\n", (int)e, int(p - data), int(q - data), sc, int(q_ref - data), sc_ref);
+                ++test_failures();
+                return;
+            }
+        }
+        for (size_t off = 0; off < 17 && off <= e; ++off) {
+            NALs nals;
+            for_each_nal(data + off, e - off, 0, [&](const uint8_t* nal, size_t len) {
+                nals.emplace_back(nal, len);
+                return true;
+            });
+            if (nals != nals_scalar(data + off, e - off)) {
+                fprintf(stderr, "for_each_nal size %d offset %d: different nal units\n", (int)e, (int)off);
+                ++test_failures();
+                return;
+            }
+        }
+    }
+}
+
+static void test_edges()
+{
+    const uint8_t sc3[] = {0, 0, 1};
+    const uint8_t sc4[] = {0, 0, 0, 1, 0x67};
+    const uint8_t tail[] = {0x65, 0x88, 0, 0}; // no 3rd byte
+    int sc = 0;
+    CHECK(find_start_code(sc3, sc3, &sc) == sc3);
+    CHECK(find_start_code(sc3, sc3 + 2, &sc) == sc3 + 2);
+    CHECK(find_start_code(sc3, sc3 + 3, &sc) == sc3 && sc == 3);
+    CHECK(find_start_code(sc4, sc4 + 5, &sc) == sc4 && sc == 4);
+    CHECK(find_start_code(sc4 + 1, sc4 + 5, &sc) == sc4 + 1 && sc == 3); // the zero before data is not a part of start code
+    CHECK(find_start_code(tail, tail + 4, &sc) == tail + 4);
+    // a start code at each position of 2 simd blocks and the tail
+    for (size_t size = 3; size <= 48; ++size) {
+        for (size_t i = 0; i + 3 <= size; ++i) {
+            vector<uint8_t> v(size, 0xff);
+            v[i] = v[i + 1] = 0;
+            v[i + 2] = 1;
+            CHECK_EQ(int(find_start_code(v.data(), v.data() + size, &sc) - v.data()), (int)i);
+            CHECK_EQ(sc, 3);
+        }
+    }
+}
+
+static void test_is_annexb()
+{
+    const uint8_t avcc[] = {1, 0x64, 0, 0x28, 0xff, 0xe1, 0, 0x19, 0x67, 0x64, 0, 0x28};
+    const uint8_t hvcc[] = {1, 1, 0x60, 0, 0, 0, 0x90, 0, 0, 0, 0, 0, 0x5d, 0xf0, 0, 0xfc, 0xfd, 0xf8, 0xf8, 0, 0, 0x0f, 3, 0x20, 0, 1, 0, 0x18, 0x40, 1, 0x0c};
+    const uint8_t annexb3[] = {0, 0, 1, 0x67, 0x64, 0, 0x28};
+    const uint8_t annexb4[] = {0, 0, 0, 1, 0x40, 1, 0x0c};
+    const uint8_t leading_zeros[] = {0, 0, 0, 0, 0, 1, 0x67};
+    const uint8_t late[] = {0x67, 0, 0, 1, 0x68}; // a start code not at the beginning
+    CHECK(!is_annexb_data(avcc, sizeof(avcc)));
+    CHECK(!is_annexb_data(hvcc, sizeof(hvcc)));
+    CHECK(is_annexb_data(annexb3, sizeof(annexb3)));
+    CHECK(is_annexb_data(annexb4, sizeof(annexb4)));
+    CHECK(is_annexb_data(leading_zeros, sizeof(leading_zeros)));
+    CHECK(!is_annexb_data(late, sizeof(late)));
+    CHECK(!is_annexb_data(annexb3, 2));
+    CHECK(!is_annexb_data(nullptr, 0));
+}
+
+static void bench()
+{
+    using clock = chrono::steady_clock;
+    const auto buf = random_stream(64 << 20, 1); // sparse zeros like slice data
+    for (int i = 0; i < 2; ++i) {
+        const auto t0 = clock::now();
+        int n = 0, sc = 0;
+        const auto end = buf.data() + buf.size();
+        for (auto p = buf.data(); p < end; ++n) {
+            p = i ? find_start_code(p, end, &sc) : find_start_code_scalar(p, end, &sc);
+            p += p < end ? sc : 0;
+        }
+        printf("64MB %s: %d start codes, %.3fms\n", i ? "find_start_code" : "scalar", n, chrono::duration<double, milli>(clock::now() - t0).count());
+    }
+}
+
+int main(int argc, char** argv)
+{
+    if (argc > 1 && strcmp(argv[1], "--bench") == 0) {
+        bench();
+        return 0;
+    }
+    test_edges();
+    test_is_annexb();
+    for (int i = 0; i < 200; ++i)
+        check_stream(random_stream(rng() % 200, 40 + i % 50));
+    for (int z : {1, 30, 90})
+        check_stream(random_stream(4099, z));
+    if (test_failures() == 0)
+        printf("nal scan: all passed\n");
+    return test_failures() != 0;
+}
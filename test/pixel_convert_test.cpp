@@ -0,0 +1,261 @@
+/*
+ * Copyright (c) 2022 WangBin <wbsecg1 at gmail.com>
+ * This file is part of MDK MFT plugin
+ * Source code: https://github.com/wang-bin/mdk-mft
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+// simd kernels are bit exact with "c" kernels for odd widths, tails and unaligned pointers
+// copy_plane_uncached() is the same as memcpy of each row on ordinary memory
+// parallel_bands() output of a conversion split into row bands is the same as 1 band
+// --bench: time of 1 frame for each implementation
+#include "PixelConvert.h"
+#include "check.h"
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace MDK_NS;
+using namespace std;
+
+static mt19937 rng(1);
+static const size_t kGuard = 64; // bytes after the last row, must not be written
+
+static vector<uint8_t> random_bytes(size_t size)
+{
+    vector<uint8_t> v(size);
+    for (auto& x : v)
+        x = (uint8_t)rng();
+    return v;
+}
+
+// plane of rows with random padding, at a random offset from 16 byte alignment
+struct Plane {
+    vector<uint8_t> mem;
+    uint8_t* data;
+    int pitch;
+
+    Plane(int bytes, int rows, uint8_t fill) {
+        pitch = bytes + int(rng() % 3) * 8;
+        mem.assign(size_t(pitch) * rows + 16 + kGuard, fill);
+        data = mem.data() + rng() % 16;
+    }
+};
+
+// run f(dst planes) with "c" and the best implementation, all bytes of dst memory must be the same
+template<typename F>
+static void check_same(const string& what, const vector<int>& dst_bytes, int rows, F&& f)
+{
+    vector<Plane> ref, out;
+    for (auto b : dst_bytes)
+        ref.emplace_back(b, rows, 0xa5);
+    out = ref;
+    for (size_t i = 0; i < out.size(); ++i)
+        out[i].data = out[i].mem.data() + (ref[i].data - ref[i].mem.data());
+    CHECK(select_pixel_convert_impl("c"));
+    f(ref);
+    CHECK(select_pixel_convert_impl(nullptr));
+    f(out);
+    for (size_t i = 0; i < out.size(); ++i) {
+        if (ref[i].mem != out[i].mem) {
+            fprintf(stderr, "%s: plane %d is different from c, %s\n", what.data(), (int)i, pixel_convert_impl());
+            ++test_failures();
+        }
+    }
+}
+
+static void test_kernels(int width, int rows)
+{
+    const auto tag = to_string(width) + "x" + to_string(rows);
+    const int cw = (width + 1) / 2;
+    { // p010 luma
+        const Plane src(width * 2, rows, 0);
+        const auto data = random_bytes(src.mem.size());
+        const auto s = data.data() + (src.data - src.mem.data());
+        for (int shift : {6, 0})
+            check_same("shift_plane16 " + tag, {width * 2}, rows, [&](vector<Plane>& d) { shift_plane16(s, src.pitch, d[0].data, d[0].pitch, width, rows, shift); });
+    }
+    { // nv12 chroma
+        const Plane src(width * 2, rows, 0);
+        const auto data = random_bytes(src.mem.size());
+        const auto s = data.data() + (src.data - src.mem.data());
+        check_same("deinterleave_uv8 " + tag, {width, width}, rows, [&](vector<Plane>& d) { deinterleave_uv8(s, src.pitch, d[0].data, d[0].pitch, d[1].data, d[1].pitch, width, rows); });
+    }
+    { // p010, p016 chroma
+        const Plane src(width * 4, rows, 0);
+        const auto data = random_bytes(src.mem.size());
+        const auto s = data.data() + (src.data - src.mem.data());
+        for (int shift : {6, 0})
+            check_same("deinterleave_uv16 " + tag, {width * 2, width * 2}, rows, [&](vector<Plane>& d) { deinterleave_uv16(s, src.pitch, d[0].data, d[0].pitch, d[1].data, d[1].pitch, width, rows, shift); });
+    }
+    { // yuy2
+        const int w = cw * 2;
+        const Plane src(w * 2, rows, 0);
+        const auto data = random_bytes(src.mem.size());
+        const auto s = data.data() + (src.data - src.mem.data());
+        check_same("yuy2_to_planar " + tag, {w, cw, cw}, rows, [&](vector<Plane>& d) { yuy2_to_planar(s, src.pitch, d[0].data, d[0].pitch, d[1].data, d[1].pitch, d[2].data, d[2].pitch, w, rows); });
+    }
+}
+
+// "c" kernels against sample values
+static void test_values()
+{
+    CHECK(select_pixel_convert_impl("c"));
+    const uint8_t nv12[] = {1, 2, 3, 4, 5, 6};
+    uint8_t u[3]{}, v[3]{};
+    deinterleave_uv8(nv12, 6, u, 3, v, 3, 3, 1);
+    CHECK(u[0] == 1 && u[1] == 3 && u[2] == 5 && v[0] == 2 && v[1] == 4 && v[2] == 6);
+    const uint16_t p010[] = {0xffc0, 0x0040, 0x8000, 0x1234};
+    uint16_t y[4]{};
+    shift_plane16((const uint8_t*)p010, 8, (uint8_t*)y, 8, 4, 1, 6);
+    CHECK(y[0] == 0x3ff && y[1] == 1 && y[2] == 0x200 && y[3] == (0x1234 >> 6));
+    uint16_t u16[2]{}, v16[2]{};
+    deinterleave_uv16((const uint8_t*)p010, 8, (uint8_t*)u16, 4, (uint8_t*)v16, 4, 2, 1, 6);
+    CHECK(u16[0] == 0x3ff && v16[0] == 1 && u16[1] == 0x200 && v16[1] == (0x1234 >> 6));
+    const uint8_t yuy2[] = {10, 20, 11, 30, 12, 21, 13, 31}; // y0 u y1 v
+    uint8_t yy[4]{}, uu[2]{}, vv[2]{};
+    yuy2_to_planar(yuy2, 8, yy, 4, uu, 2, vv, 2, 4, 1);
+    CHECK(yy[0] == 10 && yy[1] == 11 && yy[2] == 12 && yy[3] == 13 && uu[0] == 20 && uu[1] == 21 && vv[0] == 30 && vv[1] == 31);
+    CHECK(select_pixel_convert_impl(nullptr));
+}
+
+// unaligned heads and tails, rows longer than the bounce buffer, negative source pitch(bottom up)
+static void test_copy_uncached(int bytes, int rows, bool bottom_up)
+{
+    const Plane src(bytes, rows, 0);
+    const auto data = random_bytes(src.mem.size());
+    const auto s0 = data.data() + (src.data - src.mem.data());
+    const auto s = bottom_up ? s0 + ptrdiff_t(rows - 1) * src.pitch : s0;
+    const int src_pitch = bottom_up ? -src.pitch : src.pitch;
+    Plane ref(bytes, rows, 0xa5);
+    Plane out = ref;
+    out.data = out.mem.data() + (ref.data - ref.mem.data());
+    for (int i = 0; i < rows; ++i)
+        memcpy(ref.data + i * ref.pitch, s + (ptrdiff_t)i * src_pitch, bytes);
+    copy_plane_uncached(s, src_pitch, out.data, out.pitch, bytes, rows);
+    if (ref.mem != out.mem) {
+        fprintf(stderr, "copy_plane_uncached %dx%d%s is different from memcpy\n", bytes, rows, bottom_up ? " bottom up" : "");
+        ++test_failures();
+    }
+}
+
+// p010 => yuv420p10le split into row bands as MF::to() does, the same as 1 band. every band runs once
+static void test_parallel_bands(int width, int rows, int bands)
+{
+    const int cw = (width + 1) / 2, crows = (rows + 1) / 2;
+    const Plane src_y(width * 2, rows, 0), src_uv(cw * 4, crows, 0);
+    const auto data_y = random_bytes(src_y.mem.size()), data_uv = random_bytes(src_uv.mem.size());
+    const auto sy = data_y.data() + (src_y.data - src_y.mem.data());
+    const auto suv = data_uv.data() + (src_uv.data - src_uv.mem.data());
+    const auto convert = [&](vector<Plane>& d, int n) {
+        vector<atomic<int>> runs(n);
+        parallel_bands(n, [&](int band) {
+            runs[band]++;
+            const int y = int((int64_t)rows * band / n), h = int((int64_t)rows * (band + 1) / n) - y;
+            const int uvy = int((int64_t)crows * band / n), uvh = int((int64_t)crows * (band + 1) / n) - uvy;
+            shift_plane16(sy + y * src_y.pitch, src_y.pitch, d[0].data + y * d[0].pitch, d[0].pitch, width, h, 6);
+            deinterleave_uv16(suv + uvy * src_uv.pitch, src_uv.pitch, d[1].data + uvy * d[1].pitch, d[1].pitch, d[2].data + uvy * d[2].pitch, d[2].pitch, cw, uvh, 6);
+        });
+        for (const auto& r : runs)
+            CHECK(r == 1);
+    };
+    vector<Plane> ref, out;
+    ref.emplace_back(width * 2, rows, 0xa5);
+    ref.emplace_back(cw * 2, crows, 0xa5);
+    ref.emplace_back(cw * 2, crows, 0xa5);
+    out = ref;
+    for (size_t i = 0; i < out.size(); ++i)
+        out[i].data = out[i].mem.data() + (ref[i].data - ref[i].mem.data());
+    convert(ref, 1);
+    convert(out, bands);
+    for (size_t i = 0; i < out.size(); ++i) {
+        if (ref[i].mem != out[i].mem) {
+            fprintf(stderr, "parallel_bands %dx%d, %d bands: plane %d is different from 1 band\n", width, rows, bands, (int)i);
+            ++test_failures();
+        }
+    }
+}
+
+template<typename F>
+static double ms_per_frame(F&& f)
+{
+    using clock = chrono::steady_clock;
+    f(); // warm up
+    int n = 0;
+    const auto t0 = clock::now();
+    auto t = t0;
+    for (; n < 1000 && t - t0 < chrono::milliseconds(300); ++n, t = clock::now())
+        f();
+    return chrono::duration<double, milli>(t - t0).count() / n;
+}
+
+// 1 frame of each conversion for each implementation
+static void bench(int w, int h)
+{
+    vector<uint8_t> src(size_t(w) * h * 4), dst(size_t(w) * h * 4);
+    const auto s = src.data();
+    const auto d = dst.data();
+    const auto d1 = d + size_t(w) * h;
+    const auto d2 = d1 + size_t(w) * h;
+    const struct {
+        const char* name;
+        function<void()> f;
+    } cases[] = {
+        {"nv12 => yuv420p", [=]{ copy_plane(s, w, d, w, w, h); deinterleave_uv8(s, w, d1, w/2, d2, w/2, w/2, h/2); }},
+        {"p010 => yuv420p10le", [=]{ shift_plane16(s, w*2, d, w*2, w, h, 6); deinterleave_uv16(s, w*2, d1, w, d2, w, w/2, h/2, 6); }},
+        {"yuy2 => yuv422p", [=]{ yuy2_to_planar(s, w*2, d, w, d1, w/2, d2, w/2, w, h); }},
+    };
+    for (const auto& c : cases) {
+        printf("%dx%d %s:", w, h, c.name);
+        for (auto impl : {"c", ""}) {
+            select_pixel_convert_impl(impl);
+            printf(" %s %.3fms", pixel_convert_impl(), ms_per_frame(c.f));
+        }
+        printf("\n");
+    }
+    select_pixel_convert_impl(nullptr);
+    // ordinary memory, streaming loads are not expected to be faster than memcpy here, but not much slower
+    const int pitch = w + 64; // not contiguous
+    vector<uint8_t> nv12(size_t(pitch) * h * 3 / 2);
+    printf("%dx%d nv12 copy: copy_plane %.3fms copy_plane_uncached(%s) %.3fms\n", w, h
+        , ms_per_frame([&]{ copy_plane(nv12.data(), pitch, d, w, w, h * 3 / 2); })
+        , has_streaming_load() ? "streaming load" : "copy_plane"
+        , ms_per_frame([&]{ copy_plane_uncached(nv12.data(), pitch, d, w, w, h * 3 / 2); }));
+}
+
+int main(int argc, char** argv)
+{
+    if (argc > 1 && strcmp(argv[1], "--bench") == 0) {
+        bench(1920, 1080);
+        bench(3840, 2160);
+        return 0;
+    }
+    printf("pixel convert implementation: %s, streaming load: %d\n", pixel_convert_impl(), has_streaming_load());
+    test_values();
+    for (int w = 1; w <= 80; ++w)
+        test_kernels(w, 1 + w % 3);
+    for (int w : {127, 128, 129, 255, 1919, 1920, 1921})
+        test_kernels(w, 2);
+    for (int bytes = 0; bytes <= 100; ++bytes) {
+        test_copy_uncached(bytes, 1 + bytes % 3, false);
+        test_copy_uncached(bytes, 1 + bytes % 3, true);
+    }
+    for (int bytes : {4095, 4096, 4097, 4111, 5000, 8192 + 33, 3840 * 2}) {
+        test_copy_uncached(bytes, 3, false);
+        test_copy_uncached(bytes, 3, true);
+    }
+    for (int bands : {2, 3, 4, 7}) {
+        test_parallel_bands(1921, 1081, bands);
+        test_parallel_bands(64, 5, bands); // bands of 0 chroma rows
+    }
+    for (int i = 0; i < 100; ++i) // workers are reused
+        test_parallel_bands(129, 37, 4);
+    if (test_failures() == 0)
+        printf("pixel convert: all passed\n");
+    return test_failures() != 0;
+}
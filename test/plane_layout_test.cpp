@@ -0,0 +1,66 @@
+/*
+ * Copyright (c) 2022 WangBin <wbsecg1 at gmail.com>
+ * This file is part of MDK MFT plugin
+ * Source code: https://github.com/wang-bin/mdk-mft
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+// plane_layout() of the formats in mf_pixfmts(MFVideoGlue.cpp), compared with media foundation uncompressed buffer layouts:
+// https://docs.microsoft.com/en-us/windows/win32/medfound/recommended-8-bit-yuv-formats-for-video-rendering
+// https://docs.microsoft.com/en-us/windows/win32/medfound/10-bit-and-16-bit-yuv-video-formats
+#include "PlaneLayout.h"
+#include "check.h"
+#include <cstdlib>
+
+using namespace MDK_NS;
+using namespace MDK_NS::MF;
+
+struct Expected {
+    int planes;
+    int pitch[3];
+    int rows[3];
+    size_t offset[3];
+    size_t total;
+};
+
+static void check_layout(PixelFormat fmt, int w, int h, int pitch, const Expected& e)
+{
+    const auto l = plane_layout(VideoFormat(fmt), w, h, pitch);
+    CHECK_EQ(l.width, w);
+    CHECK_EQ(l.height, h);
+    CHECK_EQ(l.planes, e.planes);
+    for (int i = 0; i < e.planes; ++i) {
+        CHECK_EQ(l.pitch[i], e.pitch[i]);
+        CHECK_EQ(l.rows[i], e.rows[i]);
+        CHECK_EQ(l.offset[i], e.offset[i]);
+        CHECK_EQ(l.size[i], (size_t)std::abs(e.pitch[i]) * e.rows[i]);
+    }
+    CHECK_EQ(l.total, e.total);
+}
+
+int main()
+{
+    // IYUV, I420: Y, then U and V planes of half pitch
+    check_layout(PixelFormat::YUV420P, 1920, 1080, 2048, {3, {2048, 1024, 1024}, {1080, 540, 540}, {0, 2048*1080, 2048*1080 + 1024*540}, 2048*1080*3/2});
+    check_layout(PixelFormat::YUV420P, 1920, 1080, 0, {3, {1920, 960, 960}, {1080, 540, 540}, {0, 1920*1080, 1920*1080 + 960*540}, 1920*1080*3/2});
+    // NV12: Y, then interleaved UV of the same pitch
+    check_layout(PixelFormat::NV12, 1920, 1080, 2048, {2, {2048, 2048}, {1080, 540}, {0, 2048*1080}, 2048*1620});
+    check_layout(PixelFormat::NV12, 1920, 1088, 0, {2, {1920, 1920}, {1088, 544}, {0, 1920*1088}, 1920*1632});
+    // odd size: chroma rows and pairs are rounded up
+    check_layout(PixelFormat::NV12, 1921, 1081, 0, {2, {1921, 1922}, {1081, 541}, {0, 1921*1081}, 1921*1081 + 1922*541});
+    // bottom up: the top row of each plane is the last one in memory
+    check_layout(PixelFormat::NV12, 64, 32, -64, {2, {-64, -64}, {32, 16}, {64*31, 64*32 + 64*15}, 64*48});
+    // P010, P016: 16 bit samples, UV of the same pitch
+    check_layout(PixelFormat::P010LE, 3840, 2160, 7680, {2, {7680, 7680}, {2160, 1080}, {0, 7680*2160}, 7680*3240});
+    check_layout(PixelFormat::P016LE, 1280, 720, 2560+128, {2, {2688, 2688}, {720, 360}, {0, 2688*720}, 2688*1080});
+    // YUY2, UYVY: 1 packed plane
+    check_layout(PixelFormat::YUYV422, 1920, 1080, 4096, {1, {4096}, {1080}, {0}, 4096*1080});
+    check_layout(PixelFormat::UYVY422, 720, 576, 0, {1, {1440}, {576}, {0}, 1440*576});
+    // unknown format has no plane
+    check_layout(PixelFormat::Unknown, 16, 16, 0, {0, {}, {}, {}, 0});
+    if (test_failures() == 0)
+        std::printf("plane_layout: all passed\n");
+    return test_failures() != 0;
+}
@@ -0,0 +1,202 @@
+/*
+ * Copyright (c) 2022 WangBin <wbsecg1 at gmail.com>
+ * This file is part of MDK MFT plugin
+ * Source code: https://github.com/wang-bin/mdk-mft
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+// MF::to(VideoFrame&, sample) without copy: no heap allocation per frame after warm up(pooled buffer states), planes point to sample buffer memory,
+// software buffers are locked on 1st plane access and unlocked after the last plane is released
+#include "base/ms/MFGlue.h"
+#include "mdk/VideoFrame.h"
+#include "check.h"
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <vector>
+
+using namespace MDK_NS;
+
+static std::atomic<bool> counting{false};
+static std::atomic<int> allocations{0};
+
+void* operator new(size_t size)
+{
+    if (counting)
+        allocations++;
+    if (auto p = std::malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, size_t) noexcept { std::free(p); }
+
+MDK_NS_BEGIN
+namespace MF {
+std::shared_ptr<Buffer2D> to(ComPtr<IMF2DBuffer>, ptrdiff_t, int) { return nullptr; } // planes in separate buffers, not used by decoders
+} // namespace MF
+MDK_NS_END
+
+// software decoder output buffer
+class MemBuffer final : public ComBase<IMFMediaBuffer>
+{
+public:
+    MemBuffer(size_t size) : mem(size) {}
+    HRESULT STDMETHODCALLTYPE Lock(BYTE** data, DWORD*, DWORD* len) override {
+        locks++;
+        *data = mem.data();
+        if (len)
+            *len = (DWORD)mem.size();
+        return S_OK;
+    }
+    HRESULT STDMETHODCALLTYPE Unlock() override {
+        unlocks++;
+        return S_OK;
+    }
+    HRESULT STDMETHODCALLTYPE GetCurrentLength(DWORD* len) override {
+        *len = (DWORD)mem.size();
+        return S_OK;
+    }
+
+    std::vector<uint8_t> mem;
+    int locks = 0;
+    int unlocks = 0;
+};
+
+// 2d buffer with a pitch different from the media type's default stride, like d3d surfaces
+class Mem2DBuffer final : public ComBase<IMFMediaBuffer, IMF2DBuffer2>
+{
+public:
+    Mem2DBuffer(size_t size, LONG pitch) : mem(size), pitch(pitch) {}
+    HRESULT STDMETHODCALLTYPE Lock(BYTE**, DWORD*, DWORD*) override { return E_FAIL; } // 2d lock is used
+    HRESULT STDMETHODCALLTYPE Unlock() override { return E_FAIL; }
+    HRESULT STDMETHODCALLTYPE GetCurrentLength(DWORD* len) override {
+        *len = (DWORD)mem.size();
+        return S_OK;
+    }
+    HRESULT STDMETHODCALLTYPE Lock2D(BYTE** scanline0, LONG* p) override {
+        locks++;
+        *scanline0 = mem.data();
+        *p = pitch;
+        return S_OK;
+    }
+    HRESULT STDMETHODCALLTYPE Unlock2D() override {
+        unlocks++;
+        return S_OK;
+    }
+    HRESULT STDMETHODCALLTYPE Lock2DSize(MF2DBuffer_LockFlags, BYTE** scanline0, LONG* p, BYTE** start, DWORD* len) override {
+        *start = mem.data();
+        *len = (DWORD)mem.size();
+        return Lock2D(scanline0, p);
+    }
+
+    std::vector<uint8_t> mem;
+    LONG pitch;
+    int locks = 0;
+    int unlocks = 0;
+};
+
+class Sample final : public ComBase<IMFSample>
+{
+public:
+    Sample(ComPtr<IMFMediaBuffer> b) : buf(b) {}
+    HRESULT STDMETHODCALLTYPE GetSampleTime(LONGLONG* t) override {
+        *t = time;
+        return S_OK;
+    }
+    HRESULT STDMETHODCALLTYPE GetBufferCount(DWORD* count) override {
+        *count = 1;
+        return S_OK;
+    }
+    HRESULT STDMETHODCALLTYPE GetBufferByIndex(DWORD index, IMFMediaBuffer** b) override {
+        if (index > 0)
+            return E_FAIL;
+        *b = buf.Get();
+        buf->AddRef();
+        return S_OK;
+    }
+
+    ComPtr<IMFMediaBuffer> buf;
+    LONGLONG time = 0;
+};
+
+// frames are held by renderer or ring for a while, so several buffer states are alive at the same time
+static const int kHeld = 4;
+static const int kWarmUp = 2 * kHeld;
+static const int kFrames = 200;
+
+template<class Buf>
+static int allocations_per_frames(ComPtr<IMFSample> sample, Buf* buf, const MF::PlaneLayout& layout, int pitch)
+{
+    VideoFrame held[kHeld];
+    int n = 0;
+    for (int i = 0; i < kWarmUp + kFrames; ++i) {
+        counting = i >= kWarmUp;
+        VideoFrame frame(layout.width, layout.height, VideoFormat(layout.format));
+        CHECK(MF::to(frame, sample, layout));
+        CHECK_EQ(frame.bufferCount(), layout.planes);
+        for (int plane = 0; plane < layout.planes; ++plane) {
+            const auto b = frame.buffer(plane);
+            CHECK(b->constData() == buf->mem.data() + (pitch == layout.pitch[0] ? layout.offset[plane] : plane * (size_t)pitch * layout.rows[0]));
+            CHECK_EQ((int)b->stride(), pitch);
+        }
+        held[i % kHeld] = frame; // releases the oldest
+        counting = false;
+        if (i >= kWarmUp)
+            n = allocations;
+    }
+    for (auto& f : held)
+        f = VideoFrame();
+    CHECK_EQ(buf->locks, kWarmUp + kFrames);
+    CHECK_EQ(buf->unlocks, buf->locks);
+    allocations = 0;
+    return n;
+}
+
+static void test_software_buffer()
+{
+    auto layout = MF::plane_layout(VideoFormat(PixelFormat::NV12), 64, 36, 64);
+    layout.format = PixelFormat::NV12; // from subtype in MF::to(PlaneLayout&)
+    auto buf = make_com<MemBuffer>(layout.total);
+    auto sample = make_com<Sample>(ComPtr<IMFMediaBuffer>(buf.Get()));
+    CHECK_EQ(allocations_per_frames(ComPtr<IMFSample>(sample.Get()), buf.Get(), layout, layout.pitch[0]), 0);
+    // lazy lock: not locked until plane data is accessed, and dropped frames never lock
+    const auto locks = MF::buffer_locks();
+    {
+        VideoFrame frame(layout.width, layout.height, VideoFormat(layout.format));
+        CHECK(MF::to(frame, ComPtr<IMFSample>(sample.Get()), layout));
+        CHECK_EQ(buf->locks, buf->unlocks);
+        CHECK(frame.buffer(1)->constData() == buf->mem.data() + layout.offset[1]);
+        CHECK(frame.buffer(0)->constData() == buf->mem.data());
+        CHECK_EQ(buf->locks, buf->unlocks + 1); // locked once for all planes
+        CHECK_EQ(MF::buffer_locks(), locks + 1);
+    }
+    CHECK_EQ(buf->locks, buf->unlocks);
+    {
+        VideoFrame frame(layout.width, layout.height, VideoFormat(layout.format));
+        CHECK(MF::to(frame, ComPtr<IMFSample>(sample.Get()), layout));
+    }
+    CHECK_EQ(MF::buffer_locks(), locks + 1);
+}
+
+static void test_2d_buffer()
+{
+    auto layout = MF::plane_layout(VideoFormat(PixelFormat::NV12), 64, 36, 64);
+    layout.format = PixelFormat::NV12; // from subtype in MF::to(PlaneLayout&)
+    const int pitch = 128;
+    auto buf = make_com<Mem2DBuffer>((size_t)pitch * layout.rows[0] * 3 / 2, pitch);
+    auto sample = make_com<Sample>(ComPtr<IMFMediaBuffer>(buf.Get()));
+    CHECK_EQ(allocations_per_frames(ComPtr<IMFSample>(sample.Get()), buf.Get(), layout, pitch), 0);
+}
+
+int main()
+{
+    test_software_buffer();
+    test_2d_buffer();
+    if (test_failures() == 0)
+        printf("video buffer: all passed\n");
+    return test_failures() != 0;
+}